@@ -0,0 +1,86 @@
+#!/bin/sh
+# Runtime benchmark: compiles every program in tests/ with out/sus, runs it
+# on out/vm and prints its dynamic counts as CSV next to the stored baseline.
+#
+#   ./runtime_bench.sh            compare against tests/runtime_baseline.csv
+#   ./runtime_bench.sh --update   rewrite the baseline with the current counts
+#
+# SUS_FLAGS is passed to the compiler, e.g. SUS_FLAGS=--unroll=4.
+#
+# Fails when a program's output differs from the baseline, counts that go up
+# are only reported.
+
+cd "$(dirname "$0")" || exit 1
+
+SUS=./out/sus
+VM=./out/vm
+BASELINE=tests/runtime_baseline.csv
+HEADER="program,instructions,loads,stores,taken_branches,jumps,output_cksum"
+TMP=$(mktemp -d)
+trap 'rm -rf "$TMP"' EXIT
+
+echo "$HEADER" > "$TMP/current.csv"
+for src in tests/*.rs; do
+  name=$(basename "$src" .rs)
+  if ! $SUS $SUS_FLAGS < "$src" > "$TMP/$name.s" 2> "$TMP/$name.err"; then
+    echo "$name: compile failed" >&2
+    tail -5 "$TMP/$name.err" >&2
+    exit 1
+  fi
+  if ! $VM "$TMP/$name.s" > "$TMP/$name.out" 2> "$TMP/$name.stats"; then
+    echo "$name: vm failed" >&2
+    cat "$TMP/$name.stats" >&2
+    exit 1
+  fi
+  cksum=$(cksum < "$TMP/$name.out" | cut -d ' ' -f 1)
+  awk -F ': ' -v name="$name" -v cksum="$cksum" '
+    { stat[$1] = $2 }
+    END {
+      print name "," stat["instructions"] "," stat["loads"] "," \
+            stat["stores"] "," stat["taken branches"] "," stat["jumps"] "," cksum
+    }' "$TMP/$name.stats" >> "$TMP/current.csv"
+done
+
+if [ "$1" = "--update" ]; then
+  cp "$TMP/current.csv" "$BASELINE"
+  cat "$BASELINE"
+  exit 0
+fi
+
+if [ ! -f "$BASELINE" ]; then
+  cat "$TMP/current.csv"
+  echo "no baseline, create one with --update" >&2
+  exit 0
+fi
+
+# program, then every count as now/baseline/change
+awk -F , '
+  NR == FNR { if (FNR > 1) base[$1] = $0; next }
+  FNR == 1 {
+    print "program,instructions,base,change,loads,base,change,stores,base," \
+          "change,taken_branches,base,change,jumps,base,change,output"
+    next
+  }
+  {
+    line = $1
+    split(base[$1], b, ",")
+    for (i = 2; i <= 6; ++i) {
+      if ($1 in base && b[i] > 0) {
+        change = sprintf("%+.1f%%", ($i - b[i]) * 100 / b[i])
+      } else {
+        change = ($1 in base && $i == b[i]) ? "+0.0%" : "new"
+      }
+      line = line "," $i "," b[i] "," change
+    }
+    if (!($1 in base)) {
+      status = "new"
+    } else if ($7 == b[7]) {
+      status = "ok"
+    } else {
+      status = "CHANGED"
+      failed = 1
+    }
+    print line "," status
+  }
+  END { exit failed }
+' "$BASELINE" "$TMP/current.csv"
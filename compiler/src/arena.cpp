@@ -0,0 +1,19 @@
+#include "arena.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+std::string_view Arena::copy(std::string_view s) {
+  if (s.empty()) return {};
+  auto data = static_cast<char *>(allocate(s.size(), 1));
+  std::memcpy(data, s.data(), s.size());
+  return {data, s.size()};
+}
+
+void Arena::grow(size_t minimum) {
+  const size_t size = std::max(blockSize, minimum);
+  // not value-initialized, unlike make_unique
+  blocks.push_back({std::unique_ptr<std::byte[]>(new std::byte[size]), size});
+  next = blocks.back().data.get();
+  left = size;
+}
@@ -0,0 +1,71 @@
+#ifndef ARENA_HPP
+#define ARENA_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string_view>
+#include <vector>
+
+// Bump allocator. Objects are carved out of large blocks one after another
+// and never freed on their own, the arena drops all of them at once without
+// running destructors. Whatever lives here must not own memory elsewhere.
+class Arena {
+ public:
+  Arena() = default;
+  Arena(const Arena &) = delete;
+  Arena &operator=(const Arena &) = delete;
+
+  void *allocate(size_t size, size_t align = alignof(std::max_align_t)) {
+    size_t pad = -reinterpret_cast<uintptr_t>(next) & (align - 1);
+    if (pad + size > left) {
+      grow(size + align);
+      pad = -reinterpret_cast<uintptr_t>(next) & (align - 1);
+    }
+    void *result = next + pad;
+    next += pad + size;
+    left -= pad + size;
+    return result;
+  }
+
+  // copy of `s` that lives as long as the arena
+  std::string_view copy(std::string_view s);
+
+ private:
+  static constexpr size_t blockSize = 64 * 1024;
+
+  struct Block {
+    std::unique_ptr<std::byte[]> data;
+    size_t size;
+  };
+  std::vector<Block> blocks;
+  std::byte *next = nullptr;
+  size_t left = 0;
+
+  void grow(size_t minimum);
+};
+
+// Holds the AST of the current Compilation
+Arena &astArena();
+
+// Standard containers inside AST nodes take their storage from astArena()
+template <typename T>
+struct ArenaAllocator {
+  using value_type = T;
+
+  ArenaAllocator() = default;
+  template <typename U>
+  ArenaAllocator(const ArenaAllocator<U> &) {}
+
+  T *allocate(size_t n) {
+    return static_cast<T *>(astArena().allocate(n * sizeof(T), alignof(T)));
+  }
+  void deallocate(T *, size_t) {}
+
+  template <typename U>
+  bool operator==(const ArenaAllocator<U> &) const {
+    return true;
+  }
+};
+
+#endif  // ARENA_HPP
@@ -0,0 +1,217 @@
+// Compile-time benchmark: generates programs of growing size and times each
+// compiler phase on them separately.
+//
+// Output is CSV on stdout, one row per generated program:
+//   program,size,bytes,lex_us,parse_us,optimize_us,typecheck_us,codegen_us,asm_bytes
+// lex_us runs the scanner alone, parse_us is parsing minus that, so the
+// columns add up to the whole pipeline. Every time is the best of --repeat
+// runs. The largest programs don't fit into the 64K words of the vm:
+// asm_bytes is 0 for them and codegen_us ends where generate() gives up.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "compilation.hpp"
+
+namespace {
+
+// Nested blocks and ifs, `depth` levels deep
+std::string nesting(int depth) {
+  std::string src = "let x = 0;\n";
+  for (int i = 0; i < depth; ++i) {
+    src += i % 2 ? "{\n" : "if x < " + std::to_string(depth) + " {\n";
+    src += "let v" + std::to_string(i) + " = x + " + std::to_string(i) + ";\n";
+    src += "x += 1;\n";
+  }
+  src += "print!(x);\n";
+  for (int i = 0; i < depth; ++i) src += "}\n";
+  return src;
+}
+
+// One long block of arithmetic statements on a handful of variables
+std::string straightLine(int statements) {
+  std::string src = "let a = 1;\nlet b = 2;\nlet c = 3;\n";
+  const char *names[] = {"a", "b", "c"};
+  for (int i = 0; i < statements; ++i) {
+    const std::string dst = names[i % 3];
+    const std::string x = names[(i + 1) % 3];
+    const std::string y = names[(i + 2) % 3];
+    src += dst + " = " + x + " * " + std::to_string(i % 13 + 2) + " + (" + y +
+           " - " + dst + ") / 3 % " + std::to_string(i + 1) + ";\n";
+  }
+  src += "print!(a + b + c);\n";
+  return src;
+}
+
+// Many sibling scopes, each with its own variables, and a long chain of
+// top-level bindings that outgrows the register file
+std::string scopes(int count) {
+  std::string src = "let v0 = 1;\n";
+  for (int i = 1; i < count; ++i) {
+    const auto cur = std::to_string(i);
+    const auto prev = std::to_string(i - 1);
+    src += "let v" + cur + " = v" + prev + " + " + cur + ";\n";
+    src += "{\n  let s" + cur + " = v" + cur + " * 2;\n  let t = s" + cur +
+           " - v" + prev + ";\n  v" + cur + " = t;\n}\n";
+  }
+  src += "print!(v" + std::to_string(count - 1) + ");\n";
+  return src;
+}
+
+// The same 1000 statements on two top-level variables, `depth` scopes further
+// in. Lookups that slow down with nesting show up in the typecheck and codegen
+// columns, the rest of the input only grows by a line per scope.
+std::string deepLookup(int depth) {
+  std::string src = "let a = 1;\nlet b = 2;\n";
+  for (int i = 0; i < depth; ++i) {
+    src += "{\nlet v" + std::to_string(i) + " = b + " + std::to_string(i) +
+           ";\n";
+  }
+  for (int i = 0; i < 1000; ++i) {
+    src += "a = a + b * " + std::to_string(i % 7 + 2) + ";\n";
+  }
+  src += "print!(a);\n";
+  for (int i = 0; i < depth; ++i) src += "}\n";
+  return src;
+}
+
+// A single string literal of `length` characters
+std::string stringLiteral(int length) {
+  std::string src = "let s = \"";
+  for (int i = 0; i < length; ++i) src += static_cast<char>('a' + i % 26);
+  src += "\";\nprint!(s);\nprint!(len!(s));\nprint!(s[" +
+         std::to_string(length / 2) + "]);\n";
+  return src;
+}
+
+struct Generator {
+  std::string name;
+  std::function<std::string(int)> generate;
+  std::vector<int> sizes;
+};
+
+using Clock = std::chrono::steady_clock;
+
+long elapsedUs(Clock::time_point start) {
+  return std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() -
+                                                               start)
+      .count();
+}
+
+struct Timings {
+  long lex = 0;
+  long parse = 0;
+  long optimize = 0;
+  long typecheck = 0;
+  long codegen = 0;
+  size_t asmBytes = 0;
+  // formatted error when generate() rejected the program
+  std::string error;
+};
+
+Timings measure(const std::string &src) {
+  Timings t;
+  {
+    // the scanner writes into the text, the parse gets a fresh copy
+    Compilation unit("<bench>");
+    unit.source.assign(src);
+    const auto start = Clock::now();
+    unit.scan();
+    t.lex = elapsedUs(start);
+  }
+
+  Compilation unit("<bench>");
+  unit.source.assign(src);
+  auto start = Clock::now();
+  const bool parsed = unit.parse();
+  t.parse = std::max(0L, elapsedUs(start) - t.lex);
+  if (!parsed) {
+    std::cerr << "Generated program does not parse" << std::endl;
+    std::exit(1);
+  }
+
+  start = Clock::now();
+  optimize(unit.program);
+  t.optimize = elapsedUs(start);
+
+  start = Clock::now();
+  reset();
+  annotateTypes(unit.program);
+  t.typecheck = elapsedUs(start);
+
+  start = Clock::now();
+  try {
+    t.asmBytes = generate(unit.program).size();
+  } catch (const CompilerError &e) {
+    t.error = e.formatError(unit.source);
+  }
+  t.codegen = elapsedUs(start);
+  return t;
+}
+
+Timings best(const Timings &a, const Timings &b) {
+  return {std::min(a.lex, b.lex),
+          std::min(a.parse, b.parse),
+          std::min(a.optimize, b.optimize),
+          std::min(a.typecheck, b.typecheck),
+          std::min(a.codegen, b.codegen),
+          a.asmBytes,
+          a.error};
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+  int repeat = 3;
+  int scale = 1;
+  std::string only;
+
+  for (int i = 1; i < argc; ++i) {
+    const std::string arg = argv[i];
+    if (arg == "--repeat" && i + 1 < argc) {
+      repeat = std::max(1, std::stoi(argv[++i]));
+    } else if (arg == "--scale" && i + 1 < argc) {
+      scale = std::max(1, std::stoi(argv[++i]));
+    } else if (arg == "--only" && i + 1 < argc) {
+      only = argv[++i];
+    } else {
+      std::cerr << "usage: " << argv[0]
+                << " [--repeat N] [--scale N] [--only GENERATOR]" << std::endl;
+      return 2;
+    }
+  }
+
+  const std::vector<Generator> generators = {
+      {"nesting", nesting, {64, 128, 256, 512}},
+      {"straight_line", straightLine, {1000, 2000, 4000, 8000}},
+      {"scopes", scopes, {250, 500, 1000, 2000}},
+      {"deep_lookup", deepLookup, {64, 256, 1024, 2048}},
+      {"string_literal", stringLiteral, {4096, 16384, 65536, 262144}},
+  };
+
+  std::cout << "program,size,bytes,lex_us,parse_us,optimize_us,typecheck_us,"
+               "codegen_us,asm_bytes"
+            << std::endl;
+  for (const auto &gen : generators) {
+    if (!only.empty() && gen.name != only) continue;
+    for (const int base : gen.sizes) {
+      const int size = base * scale;
+      const auto src = gen.generate(size);
+      Timings t = measure(src);
+      for (int i = 1; i < repeat; ++i) t = best(t, measure(src));
+      if (!t.error.empty()) {
+        std::cerr << gen.name << " " << size << ": " << t.error;
+      }
+      std::cout << gen.name << "," << size << "," << src.size() << ","
+                << t.lex << "," << t.parse << "," << t.optimize << ","
+                << t.typecheck << "," << t.codegen << "," << t.asmBytes
+                << std::endl;
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,304 @@
+#include "cache.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <system_error>
+#include <vector>
+
+#if defined(__unix__)
+#define SUS_FLOCK 1
+#include <fcntl.h>
+#include <sys/file.h>
+#include <unistd.h>
+#endif
+
+#include "compilation.hpp"
+
+namespace fs = std::filesystem;
+
+namespace {
+
+// part of every key, bumped when the layout of the directory changes
+constexpr std::string_view format = "sus-cache 3";
+
+// temporary files older than this were left by a writer that died, a live
+// one renames its file within moments
+constexpr auto staleTemporary = std::chrono::minutes(10);
+
+// 64-bit FNV-1a, only names the entry, see Cache::compile()
+uint64_t hash(std::string_view bytes) {
+  uint64_t value = 0xcbf29ce484222325ull;
+  for (const unsigned char c : bytes) {
+    value ^= c;
+    value *= 0x100000001b3ull;
+  }
+  return value;
+}
+
+// The compiler binary's size and modification time, as ccache checks the
+// compiler by default. Rebuilding sus changes them and so every key.
+std::string compilerIdentity() {
+  std::error_code sizeError, timeError;
+  const fs::path self = "/proc/self/exe";
+  const auto size = fs::file_size(self, sizeError);
+  const auto time = fs::last_write_time(self, timeError);
+  if (sizeError || timeError) return __DATE__ " " __TIME__;
+  return std::to_string(size) + " " +
+         std::to_string(time.time_since_epoch().count());
+}
+
+bool readFile(const std::string &path, std::string &contents) {
+  std::ifstream in(path, std::ios::binary);
+  if (!in) return false;
+  std::ostringstream text;
+  text << in.rdbuf();
+  contents = text.str();
+  return !in.bad();
+}
+
+Cache::Stats parseStats(const std::string &text) {
+  Cache::Stats stats;
+  std::istringstream in(text);
+  std::string name;
+  uint64_t value;
+  while (in >> name >> value) {
+    if (name == "hits") stats.hits = value;
+    if (name == "misses") stats.misses = value;
+    if (name == "evictions") stats.evictions = value;
+    if (name == "bytes") stats.bytes = value;
+    if (name == "limit") stats.limit = value;
+  }
+  return stats;
+}
+
+std::string formatStats(const Cache::Stats &stats) {
+  return "hits " + std::to_string(stats.hits) + "\nmisses " +
+         std::to_string(stats.misses) + "\nevictions " +
+         std::to_string(stats.evictions) + "\nbytes " +
+         std::to_string(stats.bytes) + "\nlimit " +
+         std::to_string(stats.limit) + "\n";
+}
+
+// The statistics file, locked against other processes from opening to
+// closing where the platform has flock()
+class StatsFile {
+ public:
+  explicit StatsFile(const std::string &path) : path(path) {
+#ifdef SUS_FLOCK
+    fd = ::open(path.c_str(), O_RDWR | O_CREAT, 0644);
+    if (fd >= 0) flock(fd, LOCK_EX);
+#endif
+  }
+  ~StatsFile() {
+#ifdef SUS_FLOCK
+    if (fd >= 0) ::close(fd);  // releases the lock
+#endif
+  }
+
+  std::string read() const {
+    std::string text;
+#ifdef SUS_FLOCK
+    char chunk[256];
+    ssize_t n;
+    for (off_t at = 0; fd >= 0 && (n = pread(fd, chunk, sizeof chunk, at)) > 0;
+         at += n) {
+      text.append(chunk, n);
+    }
+#else
+    readFile(path, text);
+#endif
+    return text;
+  }
+
+  void write(const std::string &text) {
+#ifdef SUS_FLOCK
+    if (fd < 0 || ftruncate(fd, 0) != 0) return;
+    if (pwrite(fd, text.data(), text.size(), 0) < 0) return;
+#else
+    std::ofstream(path, std::ios::binary | std::ios::trunc) << text;
+#endif
+  }
+
+ private:
+  std::string path;
+#ifdef SUS_FLOCK
+  int fd = -1;
+#endif
+};
+
+}  // namespace
+
+bool Cache::open(const std::string &dir, uint64_t limit) {
+  std::error_code error;
+  fs::create_directories(dir, error);
+  if (error) return false;
+  this->dir = dir;
+  this->limit = limit;
+  compiler = compilerIdentity();
+  return true;
+}
+
+// Everything the output depends on. Every field is preceded by its length,
+// so no two different lists of fields give the same bytes and the key ends
+// where the assembly starts in an entry.
+std::string Cache::key(std::string_view text, const Options &options) const {
+  const std::string level = std::to_string(options.optLevel) + " " +
+                            std::to_string(options.unroll);
+  std::string key;
+  for (const std::string_view field : {format, std::string_view(compiler),
+                                       std::string_view(level), text}) {
+    key += std::to_string(field.size());
+    key += ':';
+    key += field;
+  }
+  return key;
+}
+
+// <dir>/<2 hex digits>/<14 hex digits>.s, 256 subdirectories keep every
+// directory small
+std::string Cache::path(std::string_view key) const {
+  char hex[17];
+  std::snprintf(hex, sizeof hex, "%016llx",
+                static_cast<unsigned long long>(hash(key)));
+  return dir + "/" + std::string(hex, 2) + "/" + std::string(hex + 2) + ".s";
+}
+
+Result Cache::compile(Compilation &unit, const Options &options, bool *hit) {
+  const auto key = this->key(unit.source.text(), options);
+  const auto entry = path(key);
+  Result result;
+  // An entry is its key followed by the assembly. One stored under the same
+  // name for another key is a miss, and replaced.
+  if (readFile(entry, result.assembly) &&
+      result.assembly.compare(0, key.size(), key) == 0) {
+    result.assembly.erase(0, key.size());
+    ++hits;
+    if (hit) *hit = true;
+    // the modification time is the last use
+    std::error_code error;
+    fs::last_write_time(entry, fs::file_time_type::clock::now(), error);
+    result.ok = true;
+    return result;
+  }
+  ++misses;
+  if (hit) *hit = false;
+  result = unit.run(options);
+  if (!result.ok) return result;
+
+  // written aside and renamed into place, readers in other threads and
+  // processes see a complete entry or none
+  std::error_code error;
+  fs::create_directories(fs::path(entry).parent_path(), error);
+  std::string temporary = entry + ".tmp" + std::to_string(temporaries++);
+#ifdef SUS_FLOCK
+  temporary += "." + std::to_string(getpid());
+#endif
+  {
+    std::ofstream out(temporary, std::ios::binary | std::ios::trunc);
+    out.write(key.data(), key.size());
+    out.write(result.assembly.data(), result.assembly.size());
+    if (!out.flush()) error = std::make_error_code(std::errc::io_error);
+  }
+  if (!error) fs::rename(temporary, entry, error);
+  if (error) {
+    fs::remove(temporary, error);
+  } else {
+    stored += key.size() + result.assembly.size();
+  }
+  return result;
+}
+
+void Cache::flush() {
+  const uint64_t newHits = hits.exchange(0);
+  const uint64_t newMisses = misses.exchange(0);
+  const uint64_t newBytes = stored.exchange(0);
+  if (dir.empty() || (!newHits && !newMisses)) return;
+
+  StatsFile file(dir + "/stats");
+  Stats stats = parseStats(file.read());
+  stats.hits += newHits;
+  stats.misses += newMisses;
+  stats.bytes += newBytes;
+  stats.limit = limit;
+  if (stats.bytes > limit) stats.evictions += evict(stats.bytes);
+  file.write(formatStats(stats));
+}
+
+Cache::Stats Cache::stats() const {
+  std::string text;
+  readFile(dir + "/stats", text);
+  return parseStats(text);
+}
+
+// Removes the least recently used entries until the rest take 90% of the
+// limit. `bytes` is counted again from the directory, entries replaced by
+// another process or removed by hand don't throw it off for long. Temporary
+// files of writers that died are removed as well, the ones still being
+// written count towards the limit. Returns the number of entries removed.
+uint64_t Cache::evict(uint64_t &bytes) const {
+  struct Entry {
+    fs::file_time_type used;
+    uint64_t size;
+    fs::path path;
+  };
+  std::vector<Entry> entries;
+  std::vector<fs::path> stale;
+  uint64_t total = 0;
+  std::error_code error;
+  const auto now = fs::file_time_type::clock::now();
+  for (fs::recursive_directory_iterator it(dir, error), end;
+       !error && it != end; it.increment(error)) {
+    // <entry>.s.tmp<n>[.<pid>], see compile()
+    const bool temporary =
+        it->path().filename().string().find(".s.tmp") != std::string::npos;
+    if ((!temporary && it->path().extension() != ".s") ||
+        !it->is_regular_file(error)) {
+      continue;
+    }
+    const auto size = it->file_size(error);
+    const auto used = it->last_write_time(error);
+    if (error) break;
+    if (temporary && now - used > staleTemporary) {
+      stale.push_back(it->path());
+      continue;
+    }
+    if (!temporary) entries.push_back({used, size, it->path()});
+    total += size;
+  }
+  for (const auto &path : stale) fs::remove(path, error);
+
+  std::sort(entries.begin(), entries.end(),
+            [](const Entry &a, const Entry &b) { return a.used < b.used; });
+  uint64_t removed = 0;
+  for (const auto &entry : entries) {
+    if (total <= limit / 10 * 9) break;
+    if (fs::remove(entry.path, error)) {
+      total -= entry.size;
+      ++removed;
+    }
+  }
+  bytes = total;
+  return removed;
+}
+
+uint64_t parseSize(std::string_view size) {
+  uint64_t value = 0;
+  size_t i = 0;
+  for (; i < size.size() && size[i] >= '0' && size[i] <= '9'; ++i) {
+    value = value * 10 + (size[i] - '0');
+  }
+  if (i == 0) return 0;
+  if (i + 1 == size.size()) {
+    switch (size[i]) {
+      case 'K': case 'k': return value << 10;
+      case 'M': case 'm': return value << 20;
+      case 'G': case 'g': return value << 30;
+      default: return 0;
+    }
+  }
+  return i == size.size() ? value : 0;
+}
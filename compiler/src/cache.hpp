@@ -0,0 +1,75 @@
+#ifndef CACHE_HPP
+#define CACHE_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+#include "sus.hpp"
+
+class Compilation;
+
+// On-disk cache of generated assembly, `sus --cache=<dir>`. Entries are
+// addressed by a hash of the program text, the options and the compiler
+// binary, so a hit is the same output compiling would produce, found
+// without scanning, parsing or generating anything. An entry is named by a
+// 64-bit hash of its key and starts with the whole key, the text included.
+// A hit needs the key to match byte for byte, so a program whose name
+// collides with another one's is compiled instead.
+//
+// An entry's modification time is its last use. Once the entries add up to
+// more than the size limit, the least recently used ones are removed until
+// they take 90% of it. That happens in flush(), at the end of a run, so a
+// long batch can go over the limit until it is done.
+//
+// The directory can be shared by any number of processes, and one Cache by
+// the threads of the batch mode.
+class Cache {
+ public:
+  struct Stats {
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    uint64_t evictions = 0;
+    // size of all entries
+    uint64_t bytes = 0;
+    // size limit the last flush() evicted down to, 0 before the first one
+    uint64_t limit = 0;
+  };
+
+  static constexpr uint64_t defaultLimit = 64ull << 20;
+
+  // false if `dir` can't be created
+  bool open(const std::string &dir, uint64_t limit = defaultLimit);
+
+  // unit.run(options), unless the cache holds the assembly of the same text
+  // compiled with the same options. Only successful results are stored.
+  // `hit` tells which of the two it was.
+  Result compile(Compilation &unit, const Options &options,
+                 bool *hit = nullptr);
+
+  // Adds this process's counts to the statistics in the directory and
+  // evicts entries when they went over the limit
+  void flush();
+
+  // statistics of the directory, as of the last flush()
+  Stats stats() const;
+
+ private:
+  std::string dir;
+  uint64_t limit = defaultLimit;
+  std::string compiler;
+  std::atomic<uint64_t> hits{0};
+  std::atomic<uint64_t> misses{0};
+  std::atomic<uint64_t> stored{0};
+  std::atomic<uint64_t> temporaries{0};
+
+  std::string key(std::string_view text, const Options &options) const;
+  std::string path(std::string_view key) const;
+  uint64_t evict(uint64_t &bytes) const;
+};
+
+// "64M" and the like: bytes with an optional K, M or G suffix, 0 if invalid
+uint64_t parseSize(std::string_view size);
+
+#endif  // CACHE_HPP
@@ -0,0 +1,53 @@
+#include "compilation.hpp"
+
+#include <utility>
+
+#include "trace.hpp"
+
+thread_local Compilation *Compilation::active = nullptr;
+
+Compilation::Compilation(std::string filename)
+    : filename(std::move(filename)), previous(active) {
+  location.filename = this->filename;
+  active = this;
+}
+
+Compilation::~Compilation() { active = previous; }
+
+Arena &astArena() { return Compilation::current().arena; }
+
+SymbolTable &symbols() { return Compilation::current().symbols; }
+
+Result Compilation::run(const Options &options) {
+  Result result;
+  try {
+    if (parse()) {
+      if (tracing(Trace::AST)) {
+        trace() << "\nAST:\n";
+        program->print();
+      }
+      optimize(program);
+      if (tracing(Trace::AST)) {
+        trace() << "\nAST after optimize():\n";
+        program->print();
+      }
+      result.assembly = compile(program, options);
+      result.ok = true;
+      return result;
+    }
+  } catch (const CompilerError &e) {
+    error = e;
+  }
+  flushTrace();  // the error comes after what was traced up to it
+  result.error = error->formatError(source);
+  result.line = error->location().line;
+  result.column = error->location().column;
+  return result;
+}
+
+Result compile(std::string_view program, const Options &options,
+               std::string_view filename) {
+  Compilation unit{std::string(filename)};
+  unit.source.assign(program);
+  return unit.run(options);
+}
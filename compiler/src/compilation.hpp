@@ -0,0 +1,68 @@
+#ifndef COMPILATION_HPP
+#define COMPILATION_HPP
+
+#include <optional>
+#include <string>
+
+#include "arena.hpp"
+#include "compiler.hpp"
+#include "error.hpp"
+#include "source.hpp"
+#include "sus.hpp"
+#include "symbol.hpp"
+
+// Everything one compilation works on: the program text, its tree and names,
+// the scanner's position, the code generator's state and the error that
+// stopped it. None of it is shared with another Compilation or outlives this
+// one.
+//
+// The phases find the compilation they work for through current(), the
+// innermost Compilation alive on the calling thread, rather than taking it
+// as a parameter through every Node method.
+class Compilation {
+ public:
+  explicit Compilation(std::string filename = "<input>");
+  ~Compilation();
+  Compilation(const Compilation &) = delete;
+  Compilation &operator=(const Compilation &) = delete;
+
+  static Compilation &current() { return *active; }
+
+  // Scans and parses `source` into `program`. False on a syntax error, which
+  // is left in `error`.
+  bool parse();
+  // Runs the scanner alone over `source`, returns the number of tokens
+  int scan();
+  // parse(), optimize() and compile() on `source`
+  Result run(const Options &options);
+
+  Source source;
+  // for error messages
+  std::string filename;
+
+  // AST nodes and the containers inside them
+  Arena arena;
+  SymbolTable symbols;
+  BlockNode *program = nullptr;
+
+  // Scanner position. `location` is the start of the last token, where
+  // errors without a place of their own point.
+  int line = 1;
+  int column = 1;
+  SourceLocation location;
+  // unroll factor of a `// #pragma unroll N` comment, taken by a `for` that
+  // is the next token and on the line after it at the latest
+  int pendingUnroll = 0;
+  // line ends since that comment
+  int pragmaLines = 0;
+
+  Ctx ctx;
+
+  std::optional<CompilerError> error;
+
+ private:
+  static thread_local Compilation *active;
+  Compilation *previous;
+};
+
+#endif  // COMPILATION_HPP
@@ -4,22 +4,56 @@
 #include <cmath>
 #include <iostream>
 #include <limits>
-#include <ranges>
 #include <regex>
 #include <sstream>
 #include <unordered_map>
 #include <variant>
 #include <vector>
 
+#include "compilation.hpp"
 #include "error.hpp"
 
-Ctx ctx;
+// code generator state of the current Compilation
+static Ctx &ctx() { return Compilation::current().ctx; }
+
+void reset() { ctx() = Ctx(); }
+
+std::string_view spelling(BinaryOp op) {
+  switch (op) {
+    case BinaryOp::ADD: return "+";
+    case BinaryOp::SUB: return "-";
+    case BinaryOp::MUL: return "*";
+    case BinaryOp::DIV: return "/";
+    case BinaryOp::REM: return "%";
+    case BinaryOp::XOR: return "^";
+    case BinaryOp::SHL: return "<<";
+    case BinaryOp::SHR: return ">>";
+    case BinaryOp::SHRU: return ">>>";
+    case BinaryOp::LT: return "<";
+    case BinaryOp::GT: return ">";
+    case BinaryOp::LE: return "<=";
+    case BinaryOp::GE: return ">=";
+    case BinaryOp::EQ: return "==";
+    case BinaryOp::NE: return "!=";
+    case BinaryOp::AND: return "&&";
+    case BinaryOp::OR: return "||";
+    case BinaryOp::INDEX: return "[]";
+  }
+  throw std::runtime_error("unreachable");
+}
 
-void reset() { ctx = Ctx(); }
+std::string_view spelling(UnaryOp op) { return op == UnaryOp::NEG ? "-" : "!"; }
+
+Label getLabel(const char *prefix) {
+  ++ctx().id;
+  ctx().labels.push_back({prefix, ctx().id});
+  return static_cast<Label>(ctx().labels.size() - 1);
+}
 
-std::string getLabel(const std::string &prefix) {
-  ++ctx.id;
-  return prefix + std::to_string(ctx.id);
+// Label of a runtime routine, printed without a numeric suffix
+Label routineLabel(const char *name) {
+  ctx().labels.push_back({name, -1});
+  return static_cast<Label>(ctx().labels.size() - 1);
 }
 
 int getTypeSize(Type t) {
@@ -28,109 +62,164 @@ int getTypeSize(Type t) {
   throw std::runtime_error("unreachable");
 }
 
-void pushHelper(std::string &res, const std::vector<std::string> &asm_lines) {
-  for (const auto &s : asm_lines) {
-    if (s.back() != ':') res += "  ";
-    res += s;
-    res += "\n";
-  }
+void emit(Op op, int rd, int rs1, int rs2, int imm = 0,
+          Label label = NO_LABEL) {
+  ctx().code.push_back({op, static_cast<uint8_t>(rd),
+                        static_cast<uint8_t>(rs1), static_cast<uint8_t>(rs2),
+                        imm, label});
 }
 
-void pushStrings(const std::vector<std::string> &asm_lines) {
-  pushHelper(ctx.strings, asm_lines);
-}
+void emitLabel(Label label) { emit(Op::LABEL, 0, 0, 0, 0, label); }
 
-void pushCommands(const std::vector<std::string> &asm_lines) {
-  pushHelper(ctx.res, asm_lines);
-}
+void emitJump(Label label) { emit(Op::JAL, 0, 0, 0, 0, label); }
+
+void emitCopy(int dst, int src) { emit(Op::ADDI, dst, src, 0, 0); }
 
 void enterScope() {
-  auto cur_offset = ctx.vars.back().first;
-  ctx.vars.push_back({});
-  ctx.vars.back().first = cur_offset;
+  ctx().vars.enter();
+  ctx().frames.push_back(ctx().frames.back());
 }
 
 void exitScope() {
-  if (ctx.vars.size() > 1) {
-    ctx.vars.pop_back();
+  if (ctx().vars.depth() > 0) {
+    ctx().vars.exit();
+    ctx().frames.pop_back();
   }
 }
 
-std::string enterBreakable() {
+void enterTypeScope() { ctx().types.enter(); }
+
+void exitTypeScope() {
+  if (ctx().types.depth() > 0) {
+    ctx().types.exit();
+  }
+}
+
+Type lookupType(Symbol name) {
+  if (auto type = ctx().types.find(name)) return *type;
+
+  nameError("Cannot find variable '" + string(name.str()) + "' in this scope");
+  throw std::runtime_error("unreachable");
+}
+
+Label enterBreakable() {
   const auto label = getLabel("break_");
-  ctx.breakable.push_back(label);
+  ctx().breakable.push_back(label);
   return label;
 }
 void exitBreakable() {
-  if (ctx.breakable.size() > 0) {
-    ctx.breakable.pop_back();
+  if (ctx().breakable.size() > 0) {
+    ctx().breakable.pop_back();
   } else {
     nameError("Unreachable exitBreakable");
   }
 }
 
-std::string enterContinuable() {
+Label enterContinuable() {
   const auto label = getLabel("contnue_");
-  ctx.continuable.push_back(label);
+  ctx().continuable.push_back(label);
   return label;
 }
 void exitContinuable() {
-  if (ctx.vars.size() > 0) {
-    ctx.continuable.pop_back();
+  if (ctx().continuable.size() > 0) {
+    ctx().continuable.pop_back();
   } else {
     nameError("Unreachable exitContinuable");
   }
 }
 
 int useReg() {
-  ++ctx.usedReg;
-  return ctx.usedReg;
+  ++ctx().usedReg;
+  if (ctx().usedReg > Ctx::lastTempReg) {
+    reportError(ErrorType::GENERAL_ERROR, "Out of expression registers");
+  }
+  return ctx().usedReg;
 }
 
-void dropReg() { --ctx.usedReg; }
+void dropReg() { --ctx().usedReg; }
 
-bool hasVar(const string &name) {
-  for (auto &[_, scope] : std::views::reverse(ctx.vars)) {
-    if (scope.count(name)) return true;
-  }
-  return false;
+bool hasVar(Symbol name) { return ctx().vars.find(name) != nullptr; }
+
+VariableInfo getVar(Symbol name) {
+  if (auto info = ctx().vars.find(name)) return *info;
+
+  nameError("Cannot find variable '" + string(name.str()) + "' in this scope");
+  throw std::runtime_error("unreachable");
 }
 
-VariableInfo getVar(const string &name) {
-  for (auto &[_, scope] : std::views::reverse(ctx.vars)) {
-    if (scope.count(name)) return scope.at(name);
+// Create a new variable with type information, `reg` 0 gives it a stack slot
+const VariableInfo createVar(Symbol name, Type type, int reg = 0) {
+  if (ctx().vars.findLocal(name)) {
+    nameError("Variable '" + string(name.str()) +
+              "' already exists in this scope");
+  }
+  if (!reg) {
+    ctx().frames.back() -= getTypeSize(type);
+    ctx().lowestSlot = std::min(ctx().lowestSlot, ctx().frames.back());
   }
+  return ctx().vars.bind(name, VariableInfo(type, ctx().frames.back(), reg));
+}
 
-  nameError("Cannot find variable '" + name + "' in this scope",
-            current_location);
-  throw std::runtime_error("unreachable");
+void Node::genInto(int reg) const {
+  gen();
+  emitCopy(reg, ctx().usedReg);
+  dropReg();
 }
 
-// Create a new variable with type information
-const VariableInfo createVar(const string &name, Type type) {
-  if (ctx.vars.back().second.count(name)) {
-    nameError("Variable '" + name + "' already exists in this scope");
+// Store the value of `expression` into a variable
+void storeVar(const VariableInfo &info, const Node &expression) {
+  if (info.reg) {
+    expression.genInto(info.reg);
+    return;
   }
-  ctx.vars.back().first -= getTypeSize(type);
-  auto info = VariableInfo(type, ctx.vars.back().first);
-  ctx.vars.back().second.emplace(name, info);
-  return info;
+  expression.gen();
+  // sw 0x, <var_offset>, <reg>
+  emit(Op::SW, 0, 0, ctx().usedReg, info.offset);
+  dropReg();
 }
 
 // Evaluate a variable node
-void VariableNode::gen() const {
+void VariableNode::gen() const { genInto(useReg()); }
+
+void VariableNode::genInto(int reg) const {
   auto info = getVar(name);
-  auto reg = useReg();
-  pushCommands({
-      "lw x" + std::to_string(reg) + ", x0, " + std::to_string(info.offset),
-  });
+  if (info.reg == reg) return;
+  if (info.reg) {
+    emitCopy(reg, info.reg);
+    return;
+  }
+  emit(Op::LW, reg, 0, 0, info.offset);
 }
 
-void NumberNode::gen() const {
-  auto reg = useReg();
-  pushCommands({
-      "li x" + std::to_string(reg) + ", " + std::to_string(this->value),
-  });
+// Register holding the node's value without emitting code, or 0
+int varReg(const Node &node) {
+  auto var = dynamic_cast<const VariableNode *>(&node);
+  return var ? getVar(var->name).reg : 0;
+}
+
+bool fitsImm12(int value) { return -2048 <= value && value < 2048; }
+
+// Literal value of the node, if it is one
+const NumberNode *literal(const Node &node) {
+  return dynamic_cast<const NumberNode *>(&node);
+}
+
+// Evaluate an operand, register variables and zero are read in place
+int genOperand(const Node &node) {
+  if (const auto reg = varReg(node)) return reg;
+  if (const auto num = literal(node); num && num->value == 0) return 0;
+  node.gen();
+  return ctx().usedReg;
+}
+
+void NumberNode::gen() const { genInto(useReg()); }
+
+void NumberNode::genInto(int reg) const {
+  if (fitsImm12(this->value)) {
+    emit(Op::ADDI, reg, 0, 0, this->value);
+  } else {
+    emit(Op::LI, reg, 0, 0, this->value);
+  }
 }
 
 std::string unescape(const std::string &input) {
@@ -196,53 +285,163 @@ std::string unescape(const std::string &input) {
 void StringNode::gen() const {
   const auto reg = useReg();
   const auto label = getLabel("str_");
-  const auto raw = unescape(this->value);
+  const string text(this->value.str());
+  const auto raw = unescape(text);
   const auto len = raw.size();
 
-  pushStrings({"# `" + this->value + "`", label + ":",
-               "data " + std::to_string(len) + " * 1"});
-
+  ctx().comments.push_back("# `" + text + "`");
+  ctx().data.push_back({Op::COMMENT, 0, 0, 0, 0,
+                        static_cast<int32_t>(ctx().comments.size() - 1)});
+  ctx().data.push_back({Op::LABEL, 0, 0, 0, 0, label});
+  ctx().data.push_back({Op::DATA, 0, 0, 0, static_cast<int32_t>(len), 1});
   for (const auto ch : raw) {
-    pushStrings({"data " + std::to_string(static_cast<int>(ch)) + " * 1"});
+    ctx().data.push_back({Op::DATA, 0, 0, 0, static_cast<int>(ch), 1});
   }
 
-  pushCommands({
-      "li x" + std::to_string(reg) + ", " + label,
-  });
+  emit(Op::LI, reg, 0, 0, 0, label);
 }
 
-Type VariableNode::typeCheck() const { return getVar(name).type; }
+Type VariableNode::typeCheck() const { return lookupType(name); }
 
 // op -> asm_op, swap
-std::unordered_map<std::string, std::pair<std::string, bool>> bin_int_ops = {
-    {"+", {"add", false}},   {"-", {"sub", false}},  {"^", {"xor", false}},
-    {">>>", {"slr", false}}, {">>", {"sra", false}}, {"||", {"or", false}},
-    {"&&", {"and", false}},  {"*", {"mul", false}},  {"/", {"div", false}},
-    {"%", {"rem", false}},   {"<<", {"sll", false}}, {"<", {"slt", false}},
-    {"==", {"seq", false}},  {"!=", {"sne", false}}, {">=", {"sge", false}},
-    {"<=", {"sge", true}},   {">", {"slt", true}},
+const std::unordered_map<BinaryOp, std::pair<Op, bool>> bin_int_ops = {
+    {BinaryOp::ADD, {Op::ADD, false}}, {BinaryOp::SUB, {Op::SUB, false}},
+    {BinaryOp::XOR, {Op::XOR, false}}, {BinaryOp::SHRU, {Op::SRL, false}},
+    {BinaryOp::SHR, {Op::SRA, false}}, {BinaryOp::MUL, {Op::MUL, false}},
+    {BinaryOp::DIV, {Op::DIV, false}}, {BinaryOp::REM, {Op::REM, false}},
+    {BinaryOp::SHL, {Op::SLL, false}}, {BinaryOp::LT, {Op::SLT, false}},
+    {BinaryOp::EQ, {Op::SEQ, false}},  {BinaryOp::NE, {Op::SNE, false}},
+    {BinaryOp::GE, {Op::SGE, false}},  {BinaryOp::LE, {Op::SGE, true}},
+    {BinaryOp::GT, {Op::SLT, true}},
 };
 
-void BinaryNode::gen() const {
-  Type leftType = left->typeCheck();
-  Type rightType = right->typeCheck();
+// && and || evaluate to 0 or 1 and skip the right operand when the left one
+// decides the result
+bool isLogical(BinaryOp op) {
+  return op == BinaryOp::AND || op == BinaryOp::OR;
+}
 
-  left->gen();
-  right->gen();
+void genBranch(const Node &cond, bool when, Label label);
 
-  dropReg();
-  std::string left = "x" + std::to_string(ctx.usedReg);
-  std::string right = "x" + std::to_string(ctx.usedReg + 1);
+int BinaryNode::need() const {
+  if (!cachedNeed) {
+    const int l = left->need();
+    const int r = right->need();
+    // the operands of a logical operator are never live at the same time
+    cachedNeed = l == r && !isLogical(op) ? l + 1 : std::max(l, r);
+  }
+  return cachedNeed;
+}
+
+// op -> asm_op with a 12-bit immediate, the constant may be on either side
+const std::unordered_map<BinaryOp, Op> bin_imm_ops = {
+    {BinaryOp::ADD, Op::ADDI},
+    {BinaryOp::XOR, Op::XORI},
+};
+
+// Picks the immediate form when one operand is a small literal. The other
+// operand is evaluated as usual and the result written to `dst`.
+bool genImmediate(const BinaryNode &node, int dst) {
+  if (node.left->type != Type::I32 || node.right->type != Type::I32) {
+    return false;
+  }
+  auto constant = literal(*node.right);
+  const Node *other = node.left.get();
+  if (!constant && bin_imm_ops.count(node.op)) {
+    constant = literal(*node.left);
+    other = node.right.get();
+  }
+  if (!constant) return false;
+
+  Op asm_command;
+  int imm = constant->value;
+  if (bin_imm_ops.count(node.op)) {
+    asm_command = bin_imm_ops.at(node.op);
+  } else if (node.op == BinaryOp::SUB && imm != INT32_MIN) {
+    asm_command = Op::ADDI;
+    imm = -imm;
+  } else {
+    return false;
+  }
+  if (!fitsImm12(imm)) return false;
+
+  const int target = ctx().usedReg + 1;
+  const auto src = genOperand(*other);
+  ctx().usedReg = target - 1;
+  emit(asm_command, dst, src, 0, imm);
+  return true;
+}
+
+void BinaryNode::gen() const {
+  genInto(ctx().usedReg + 1);
+  useReg();
+}
+
+// Evaluates both operands, returns the registers holding left and right.
+// The temporaries are released, the caller consumes them right away.
+std::pair<int, int> genOperands(const BinaryNode &node) {
+  // Sethi-Ullman: evaluate the hungrier operand first, so the other one
+  // runs with one register less in use
+  const int target = ctx().usedReg + 1;
+  const bool rightFirst = node.right->need() > node.left->need();
+  const Node &first = rightFirst ? *node.right : *node.left;
+  const Node &second = rightFirst ? *node.left : *node.right;
+
+  int firstReg = genOperand(first);
+  int secondReg;
+  if (ctx().usedReg == target &&
+      second.need() > Ctx::lastTempReg - target) {
+    // not enough registers left, park the first result in the spill area;
+    // x<target+1> is still free and serves as the base address
+    const int slot = ctx().spill_begin + ctx().spillDepth++;
+    const int high = slot >> 12;
+    const int low = slot & 0xFFF;
+    const int base = target + 1;
+    emit(Op::LUI, base, 0, 0, high);
+    emit(Op::SW, 0, base, firstReg, low);
+    dropReg();
+    secondReg = genOperand(second);
+    firstReg = base;
+    emit(Op::LUI, base, 0, 0, high);
+    emit(Op::LW, base, base, 0, low);
+    --ctx().spillDepth;
+  } else {
+    secondReg = genOperand(second);
+  }
+  ctx().usedReg = target - 1;
+
+  if (rightFirst) return {secondReg, firstReg};
+  return {firstReg, secondReg};
+}
+
+void BinaryNode::genInto(int reg) const {
+  Type leftType = left->type;
+  Type rightType = right->type;
+  const int dst = reg;
+  if (isLogical(op) && leftType == Type::I32 && rightType == Type::I32) {
+    const auto is_false = getLabel("false_");
+    const auto end = getLabel("logic_end_");
+    genBranch(*this, false, is_false);
+    emit(Op::ADDI, dst, 0, 0, 1);
+    emitJump(end);
+    emitLabel(is_false);
+    emit(Op::ADDI, dst, 0, 0, 0);
+    emitLabel(end);
+    return;
+  }
+  if (genImmediate(*this, dst)) return;
+
+  auto [left, right] = genOperands(*this);
 
   if (leftType == Type::I32 && rightType == Type::I32 &&
       bin_int_ops.count(op)) {
     const auto [asm_command, swap] = bin_int_ops.at(op);
     if (swap) std::swap(left, right);
-    pushCommands({asm_command + " x" + std::to_string(ctx.usedReg) + ", " +
-                  left + ", " + right});
-  } else if (leftType == Type::STR && rightType == Type::I32 && op == "[]") {
-    pushCommands({"add " + left + ", " + left + ", " + right,
-                  "lw " + left + ", " + left + ", 1"});
+    emit(asm_command, dst, left, right);
+  } else if (leftType == Type::STR && rightType == Type::I32 &&
+             op == BinaryOp::INDEX) {
+    emit(Op::ADD, dst, left, right);
+    emit(Op::LW, dst, dst, 0, 1);
   } else {
     typeError("Invalid types: " + typeToString(static_cast<int>(leftType)) +
               " and " + typeToString(static_cast<int>(rightType)));
@@ -250,18 +449,19 @@ void BinaryNode::gen() const {
 }
 
 Type BinaryNode::typeCheck() const {
-  Type leftType = left->typeCheck();
-  Type rightType = right->typeCheck();
+  Type leftType = left->annotate();
+  Type rightType = right->annotate();
 
   if (leftType == Type::I32 && rightType == Type::I32 &&
-      bin_int_ops.count(op)) {
+      (bin_int_ops.count(op) || isLogical(op))) {
     return Type::I32;
-  } else if (leftType == Type::STR && rightType == Type::I32 && op == "[]") {
+  } else if (leftType == Type::STR && rightType == Type::I32 &&
+             op == BinaryOp::INDEX) {
     return Type::I32;
   } else {
     typeError("Invalid types: " + typeToString(static_cast<int>(leftType)) +
               " and " + typeToString(static_cast<int>(rightType)) +
-              " for operator `" + op + "`");
+              " for operator `" + string(spelling(op)) + "`");
   }
 
   return Type::UNKNOWN;
@@ -270,82 +470,94 @@ Type BinaryNode::typeCheck() const {
 void UnaryNode::gen() const {
   right->gen();
 
-  Type rightType = right->typeCheck();
-  std::string right = "x" + std::to_string(ctx.usedReg);
+  const int right = ctx().usedReg;
 
-  if (op == "-") {
-    pushCommands({"sub " + right + ", x0, " + right});
+  if (op == UnaryOp::NEG) {
+    emit(Op::SUB, right, 0, right);
   } else {
-    pushCommands({"seq " + right + ", x0, " + right});
+    emit(Op::SEQ, right, 0, right);
   }
 }
 
 Type UnaryNode::typeCheck() const {
-  Type rightType = right->typeCheck();
+  Type rightType = right->annotate();
 
   if (rightType != Type::I32) {
-    typeError("Unary '" + this->op + "' requires i32 operand");
+    typeError("Unary '" + string(spelling(op)) + "' requires i32 operand");
   }
   return rightType;
 }
 
-const std::unordered_map<std::string,
-                         std::unordered_map<Type, std::pair<std::string, Type>>>
-    macros = {{"print!",
-               {{Type::I32, {"print_i32", Type::UNKNOWN}},
-                {Type::STR, {"print_str", Type::UNKNOWN}}}},
-              {"len!", {{Type::STR, {"len_str", Type::I32}}}},
-              {"print_char!", {{Type::I32, {"print_char", Type::UNKNOWN}}}}};
+// Macro backed by a runtime routine. Routines that are a single instruction
+// are expanded in place rather than called, `expand` emits that instruction
+// reading the argument from `arg` and writing the result to `dst`.
+struct Macro {
+  const char *routine;
+  Type result;
+  void (*expand)(int dst, int arg) = nullptr;
+};
 
-void MacroNode::gen() const {
-  this->typeCheck();
-  this->arg->gen();
-  dropReg();
+const std::unordered_map<std::string_view, std::unordered_map<Type, Macro>>
+    macros = {
+        {"print!",
+         {{Type::I32, {"print_i32", Type::UNKNOWN}},
+          {Type::STR, {"print_str", Type::UNKNOWN}}}},
+        {"len!",
+         {{Type::STR,
+           {"len_str", Type::I32,
+            [](int dst, int arg) { emit(Op::LW, dst, arg, 0, 0); }}}}},
+        {"print_char!",
+         {{Type::I32,
+           {"print_char", Type::UNKNOWN,
+            [](int, int arg) { emit(Op::EWRITE, 0, arg, 0); }}}}}};
 
-  const auto type = arg->typeCheck();
+void MacroNode::gen() const {
+  const auto &macro = macros.at(name.str()).at(arg->type);
 
-  const auto macro = macros.at(this->name).at(type);
-  pushCommands({"jal x31, " + macro.first});
-  if (macro.second != Type::UNKNOWN) {
+  if (macro.expand) {
+    const int target = ctx().usedReg + 1;
+    const auto src = genOperand(*arg);
+    ctx().usedReg = target - 1;
+    macro.expand(target, src);
+  } else {
+    this->arg->gen();
+    dropReg();
+    emit(Op::JAL, 31, 0, 0, 0, routineLabel(macro.routine));
+  }
+  if (macro.result != Type::UNKNOWN) {
     useReg();
   }
 }
 
 Type MacroNode::typeCheck() const {
-  if (macros.count(this->name) == 0) {
-    nameError("Unknown macro '" + name + "'");
+  if (macros.count(name.str()) == 0) {
+    nameError("Unknown macro '" + string(name.str()) + "'");
   }
-  const auto type = arg->typeCheck();
-  if (macros.at(this->name).count(type) == 0) {
-    nameError("Macro '" + name + "' doesn't support type `" +
+  const auto type = arg->annotate();
+  if (macros.at(name.str()).count(type) == 0) {
+    nameError("Macro '" + string(name.str()) + "' doesn't support type `" +
               typeToString(static_cast<int>(type)));
   }
-  const auto macro = macros.at(this->name).at(type);
-  return macro.second;
+  return macros.at(name.str()).at(type).result;
 }
 
 void AssignNode::gen() const {
-  this->typeCheck();
   if (!hasVar(name)) {
-    nameError("Undefined variable '" + name + "'");
+    nameError("Undefined variable '" + string(name.str()) + "'");
   }
 
   VariableInfo info = getVar(name);
 
-  expression->gen();
-  pushCommands({// sw 0x, <var_offset>, <reg>
-                "sw x0, " + std::to_string(info.offset) + ", x" +
-                std::to_string(ctx.usedReg)});
-  dropReg();
+  storeVar(info, *expression);
 }
 
 Type AssignNode::typeCheck() const {
-  Type exprType = expression->typeCheck();
-  Type varType = getVar(name).type;
+  Type exprType = expression->annotate();
+  Type varType = lookupType(name);
 
   if (varType != exprType && varType != Type::UNKNOWN) {
     typeError("Cannot assign " + typeToString(static_cast<int>(exprType)) +
-              " to variable '" + name + "' of type " +
+              " to variable '" + string(name.str()) + "' of type " +
               typeToString(static_cast<int>(varType)));
   }
 
@@ -353,58 +565,121 @@ Type AssignNode::typeCheck() const {
 }
 
 void VarDeclNode::gen() const {
-  this->typeCheck();
+  // the initializer can't see the new binding, evaluate it first
+  if (reg) {
+    expression->genInto(reg);
+    createVar(name, this->type, reg);
+    return;
+  }
   expression->gen();
-  const auto info =
-      createVar(name, declaredType == Type::UNKNOWN ? expression->typeCheck()
-                                                    : declaredType);
-  pushCommands({// sw 0x, <var_offset>, <reg>
-                "sw x0, " + std::to_string(info.offset) + ", x" +
-                std::to_string(ctx.usedReg)});
+  const auto info = createVar(name, this->type);
+  // sw 0x, <var_offset>, <reg>
+  emit(Op::SW, 0, 0, ctx().usedReg, info.offset);
   dropReg();
 }
 
 Type VarDeclNode::typeCheck() const {
-  Type exprType = expression->typeCheck();
+  Type exprType = expression->annotate();
 
   if (declaredType != Type::UNKNOWN && declaredType != exprType) {
     typeError("Cannot initialize " +
               typeToString(static_cast<int>(declaredType)) + " variable '" +
-              name + "' with " + typeToString(static_cast<int>(exprType)) +
+              string(name.str()) + "' with " +
+              typeToString(static_cast<int>(exprType)) +
               " value");
   }
 
-  return declaredType == Type::UNKNOWN ? exprType : declaredType;
+  const auto varType = declaredType == Type::UNKNOWN ? exprType : declaredType;
+  ctx().types.bind(name, varType);
+  return varType;
+}
+
+// op -> {branch, swap operands}, taken when the relation holds
+const std::unordered_map<BinaryOp, std::pair<Op, bool>> branch_ops = {
+    {BinaryOp::LT, {Op::BLT, false}}, {BinaryOp::GE, {Op::BGE, false}},
+    {BinaryOp::GT, {Op::BLT, true}},  {BinaryOp::LE, {Op::BGE, true}},
+    {BinaryOp::EQ, {Op::BEQ, false}}, {BinaryOp::NE, {Op::BNE, false}},
+};
+
+const std::unordered_map<BinaryOp, BinaryOp> negated_relations = {
+    {BinaryOp::LT, BinaryOp::GE}, {BinaryOp::GE, BinaryOp::LT},
+    {BinaryOp::GT, BinaryOp::LE}, {BinaryOp::LE, BinaryOp::GT},
+    {BinaryOp::EQ, BinaryOp::NE}, {BinaryOp::NE, BinaryOp::EQ},
+};
+
+const BinaryNode *relation(const Node &node) {
+  auto bin = dynamic_cast<const BinaryNode *>(&node);
+  if (!bin || !branch_ops.count(bin->op) || bin->left->type != Type::I32 ||
+      bin->right->type != Type::I32) {
+    return nullptr;
+  }
+  return bin;
+}
+
+// Jumps to `label` when the truth value of `cond` equals `when`, falls
+// through otherwise. Relations map onto a single conditional branch.
+void genBranch(const Node &cond, bool when, Label label) {
+  if (auto num = dynamic_cast<const NumberNode *>(&cond)) {
+    if ((num->value != 0) == when) emitJump(label);
+    return;
+  }
+  if (auto unary = dynamic_cast<const UnaryNode *>(&cond);
+      unary && unary->op == UnaryOp::NOT) {
+    return genBranch(*unary->right, !when, label);
+  }
+  if (auto bin = relation(cond)) {
+    const auto op = when ? bin->op : negated_relations.at(bin->op);
+    auto [left, right] = genOperands(*bin);
+    const auto [asm_command, swap] = branch_ops.at(op);
+    if (swap) std::swap(left, right);
+    emit(asm_command, 0, left, right, 0, label);
+    return;
+  }
+  if (auto bin = dynamic_cast<const BinaryNode *>(&cond);
+      bin && isLogical(bin->op) && bin->type == Type::I32) {
+    // a && b is false as soon as a is, a || b is true as soon as a is
+    const bool shortCircuit = bin->op == BinaryOp::OR;
+    if (when == shortCircuit) {
+      genBranch(*bin->left, when, label);
+      genBranch(*bin->right, when, label);
+    } else {
+      const auto skip = getLabel("skip_");
+      genBranch(*bin->left, !when, skip);
+      genBranch(*bin->right, when, label);
+      emitLabel(skip);
+    }
+    return;
+  }
+  const int used = ctx().usedReg;
+  const auto value = genOperand(cond);
+  ctx().usedReg = used;
+  emit(when ? Op::BNE : Op::BEQ, 0, value, 0, 0, label);
 }
 
 void IfNode::gen() const {
-  this->typeCheck();
-  condition->gen();
-  std::string else_label = getLabel("else_");
-  std::string if_end = getLabel("if_end_");
-  dropReg();
-  pushCommands({
-      "bne x1, x0, 1",
-      "jal x0, " + else_label,
-  });
+  const auto else_label = getLabel("else_");
+  const auto if_end = getLabel("if_end_");
+  genBranch(*condition, false, else_label);
   thenBlock->gen();
-  pushCommands({
-      "jal x0, " + if_end,
-      else_label + ":",
-  });
   if (elseBlock) {
+    emitJump(if_end);
+    emitLabel(else_label);
     elseBlock->gen();
+    emitLabel(if_end);
+  } else {
+    emitLabel(else_label);
   }
-  pushCommands({
-      if_end + ":",
-  });
 }
 
 Type IfNode::typeCheck() const {
-  Type condType = condition->typeCheck();
+  Type condType = condition->annotate();
   if (condType != Type::I32) {
     typeError("If condition must be a i32");
   }
+  thenBlock->annotate();
+  if (elseBlock) {
+    elseBlock->annotate();
+  }
 
   return Type::UNKNOWN;
 }
@@ -420,36 +695,97 @@ void BlockNode::gen() const {
   exitScope();
 }
 
-Type BlockNode::typeCheck() const { return Type::UNKNOWN; }
+Type BlockNode::typeCheck() const {
+  enterTypeScope();
+
+  for (const auto &stmt : statements) {
+    stmt->annotate();
+  }
+
+  exitTypeScope();
+  return Type::UNKNOWN;
+}
 
 // Evaluate a while loop
+// Body and step `count` times over, without testing the condition
+void genIterations(const LoopNode &loop, int64_t count) {
+  for (int64_t i = 0; i < count; ++i) {
+    const auto continue_label = enterContinuable();
+    loop.block->gen();
+    emitLabel(continue_label);
+    if (loop.after_loop) loop.after_loop->gen();
+    exitContinuable();
+  }
+}
+
+// Nodes all copies of an unrolled body may add up to
+constexpr int unrollBudget = 256;
+
+// Copies of the body LoopNode::gen emits for `factor`, the odd iterations in
+// front of the loop included
+static int64_t unrolledCopies(const LoopNode &loop, int factor) {
+  if (loop.tripCount < factor) return loop.tripCount;
+  return factor + loop.tripCount % factor;
+}
+
+// Copies of the body per test of the condition, 1 to keep the loop rolled.
+// Factors are at most Options::maxUnroll, so a loop is only unrolled
+// completely when it runs fewer times than that, and a large body gets
+// fewer copies than asked for.
+int unrollFactor(const LoopNode &loop) {
+  if (loop.tripCount < 0 || !loop.condition) return 1;
+  int factor = loop.unroll;
+  if (factor == 0) factor = loop.innermost ? ctx().unroll : 1;
+  factor = std::clamp(factor, 1, Options::maxUnroll);
+  while (factor > 1 &&
+         unrolledCopies(loop, factor) * loop.bodySize > unrollBudget) {
+    --factor;
+  }
+  return factor;
+}
+
 void LoopNode::gen() const {
   enterScope();
   if (init) {
     init->gen();
   }
-  this->typeCheck();
   const auto break_label = enterBreakable();
-  const auto continue_label = enterContinuable();
 
-  pushCommands({
-      continue_label + ":",
-  });
+  if (const int factor = unrollFactor(*this); factor > 1) {
+    // the odd iterations run first, what remains is a multiple of the factor
+    // and the condition only has to be tested after every full round
+    genIterations(*this, tripCount % factor);
+    if (tripCount >= factor) {
+      const auto body_label = getLabel("loop_");
+      emitLabel(body_label);
+      genIterations(*this, factor);
+      genBranch(*condition, true, body_label);
+    }
+    emitLabel(break_label);
+    exitBreakable();
+    exitScope();
+    return;
+  }
 
-  condition->gen();
-  dropReg();
-  pushCommands({
-      "bne x1, x0, 1",
-      "jal x0, " + break_label,
-  });
+  const auto continue_label = enterContinuable();
+  const auto body_label = getLabel("loop_");
+  const auto cond_label = getLabel("loop_cond_");
+
+  // the condition sits after the body, an iteration takes a single branch
+  if (condition) emitJump(cond_label);
+  emitLabel(body_label);
   this->block->gen();
+  emitLabel(continue_label);
   if (this->after_loop) {
     this->after_loop->gen();
   }
-  pushCommands({
-      "jal x0, " + continue_label,
-      break_label + ":",
-  });
+  if (condition) {
+    emitLabel(cond_label);
+    genBranch(*condition, true, body_label);
+  } else {
+    emitJump(body_label);
+  }
+  emitLabel(break_label);
 
   exitBreakable();
   exitContinuable();
@@ -457,21 +793,28 @@ void LoopNode::gen() const {
 }
 
 Type LoopNode::typeCheck() const {
+  enterTypeScope();
+  if (init) {
+    init->annotate();
+  }
   if (this->condition) {
-    Type condType = condition->typeCheck();
+    Type condType = condition->annotate();
     if (condType != Type::I32) {
       typeError("If condition must be a i32");
     }
   }
+  block->annotate();
+  if (after_loop) {
+    after_loop->annotate();
+  }
+  exitTypeScope();
 
   return Type::UNKNOWN;
 }
 
 void BreakNode::gen() const {
-  if (ctx.breakable.size()) {
-    pushCommands({
-        "jal x0, " + ctx.breakable.back(),
-    });
+  if (ctx().breakable.size()) {
+    emitJump(ctx().breakable.back());
   } else {
     nameError("Not in context to break");
   }
@@ -479,10 +822,8 @@ void BreakNode::gen() const {
 Type BreakNode::typeCheck() const { return Type::UNKNOWN; }
 
 void ContinueNode::gen() const {
-  if (ctx.continuable.size()) {
-    pushCommands({
-        "jal x0, " + ctx.continuable.back(),
-    });
+  if (ctx().continuable.size()) {
+    emitJump(ctx().continuable.back());
   } else {
     nameError("Not in context to break");
   }
@@ -490,9 +831,108 @@ void ContinueNode::gen() const {
 
 Type ContinueNode::typeCheck() const { return Type::UNKNOWN; }
 
-std::string compile(BlockNode *block) {
+// Single pass over the tree, caches every node's type for gen()
+void annotateTypes(BlockNode *block) { block->annotate(); }
+
+std::string compile(BlockNode *block, const Options &options) {
   reset();
+  annotateTypes(block);
+  return generate(block, options);
+}
+
+// Characters of 00..99 for print_i32
+void emitDigitPairs() {
+  ctx().comments.push_back("# digit pairs");
+  ctx().data.push_back({Op::COMMENT, 0, 0, 0, 0,
+                        static_cast<int32_t>(ctx().comments.size() - 1)});
+  ctx().data.push_back({Op::LABEL, 0, 0, 0, 0, routineLabel("digit_pairs")});
+  for (int i = 0; i < 100; ++i) {
+    ctx().data.push_back({Op::DATA, 0, 0, 0, '0' + i / 10, 1});
+    ctx().data.push_back({Op::DATA, 0, 0, 0, '0' + i % 10, 1});
+  }
+}
+
+// Whether the generated code calls the runtime routine `name`
+static bool calls(std::string_view name) {
+  return std::any_of(ctx().code.begin(), ctx().code.end(), [&](const Instr &i) {
+    return i.op == Op::JAL && i.rd == 31 && i.aux != NO_LABEL &&
+           ctx().labels[i.aux].prefix == name;
+  });
+}
+
+// Memory words of assembler text: one per instruction, two for the `li` of
+// a label as in instrSize(), none for labels, comments and blank lines
+static int textWords(std::string_view text) {
+  int words = 0;
+  while (!text.empty()) {
+    const auto end = std::min(text.find('\n'), text.size());
+    auto line = text.substr(0, end);
+    text.remove_prefix(std::min(end + 1, text.size()));
+    line = line.substr(0, line.find('#'));
+    const auto first = line.find_first_not_of(" \t");
+    if (first == std::string_view::npos) continue;
+    line = line.substr(first, line.find_last_not_of(" \t") + 1 - first);
+    if (line.back() == ':') continue;
+    words += line.starts_with("li ") ? 2 : 1;
+  }
+  return words;
+}
+
+// --trace=gen line with the size of the code after `pass`
+static void traceCode(const char *pass) {
+  if (tracing(Trace::GEN)) {
+    trace() << "gen: " << pass << ": " << ctx().code.size() << " instructions, "
+            << ctx().data.size() << " data\n";
+  }
+}
+
+std::string generate(BlockNode *block, const Options &options) {
+  ctx().unroll = options.unroll;
+  allocateRegisters(block);
   block->gen();
-  pushCommands({"ebreak"});
-  return ctx.prefix + ctx.strings + ctx.res;
-}
\ No newline at end of file
+  emit(Op::EBREAK, 0, 0, 0);
+  traceCode("codegen");
+  if (options.optLevel >= 1) {
+    // threading jumps can leave blocks without predecessors, whose removal
+    // in turn gives the peephole pass more to do
+    do {
+      peephole(ctx().code, ctx().labels.size());
+      traceCode("peephole");
+    } while (removeUnreachable(ctx().code, ctx().labels.size()));
+    removeUnusedData(ctx().data, ctx().code, ctx().labels.size());
+    traceCode("dead code");
+  }
+  relaxBranches(ctx().code, ctx().labels.size());
+  traceCode("branch relaxation");
+
+  AsmWriter writer(ctx().labels, ctx().comments);
+  writer.reserve(Ctx::prefix.size() + 1024 +
+                 16 * (ctx().code.size() + ctx().data.size()));
+  writer.text(Ctx::prefix);
+  int words = textWords(Ctx::prefix);
+  // only the routines the program calls are linked in
+  for (const auto &routine : Ctx::runtime) {
+    if (!calls(routine.name)) continue;
+    writer.text(routine.code);
+    words += textWords(routine.code);
+    if (routine.data) routine.data();
+  }
+  writer.text(Ctx::runtime_end);
+
+  // the image is loaded at address 0, variables kept in memory sit below
+  // stack_begin and must not be overwritten by it
+  for (const auto &i : ctx().data) words += instrSize(i);
+  for (const auto &i : ctx().code) words += instrSize(i);
+  if (words > ctx().lowestSlot) {
+    reportError(ErrorType::GENERAL_ERROR,
+                "Program of " + std::to_string(words) +
+                    " words does not fit into memory below address " +
+                    std::to_string(ctx().lowestSlot),
+                SourceLocation());
+  }
+  writer.text("\n# BEGIN STRINGS\n");
+  writer.write(ctx().data);
+  writer.text("\n# BEGIN MAIN\nmain:\n");
+  writer.write(ctx().code);
+  return writer.take();
+}
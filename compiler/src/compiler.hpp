@@ -5,119 +5,229 @@
 #include <iostream>
 #include <memory>
 #include <string>
+#include <string_view>
 #include <unordered_map>
 #include <variant>
 #include <vector>
 
+#include "arena.hpp"
+#include "ir.hpp"
+#include "scoped_table.hpp"
+#include "sus.hpp"
+#include "symbol.hpp"
+#include "trace.hpp"
+
 using string = std::string;
 
 enum class Type { I32, STR, UNKNOWN };
 
+// `^`, `>>` and `>>>` have no token yet, codegen already handles them
+enum class BinaryOp : uint8_t {
+  ADD,
+  SUB,
+  MUL,
+  DIV,
+  REM,
+  XOR,
+  SHL,
+  SHR,
+  SHRU,
+  LT,
+  GT,
+  LE,
+  GE,
+  EQ,
+  NE,
+  AND,
+  OR,
+  INDEX,  // s[i]
+};
+
+enum class UnaryOp : uint8_t { NEG, NOT };
+
+// source spelling, for the AST dump and error messages
+std::string_view spelling(BinaryOp op);
+std::string_view spelling(UnaryOp op);
+
 struct VariableInfo {
   Type type;
   int offset;
-  VariableInfo(Type t, int o) : type(t), offset(o) {}
+  int reg;  // 0 when the variable lives in memory at `offset`
+  VariableInfo(Type t, int o, int r = 0) : type(t), offset(o), reg(r) {}
+};
+
+// Runtime routine, linked into the output when the program calls it
+struct Routine {
+  const char *name;
+  std::string_view code;
+  // appends the tables the routine reads to the strings section
+  void (*data)() = nullptr;
 };
 
+void emitDigitPairs();
+
 struct Ctx {
-  std::string prefix = R"(
+  static constexpr std::string_view prefix = R"(
 jal x0, main
 
 # BEGIN MACROS
-print_i32:
-  addi x10, x0, 10
-  addi x11, x0, 1023
-  addi x12, x1, 0
-  addi x13, x0, 0
-  addi x14, x11, 0
-  bge  x12, x0, producer_loop
-  addi x13, x0, 1
-  sub x12, x0, x12
-
-producer_loop:
-  div x15, x12, x10
-  rem x16, x12, x10
-  addi x20, x16, 48
-  sw x14, 0, x20
-  addi x14, x14, -1
-  addi x12, x15, 0
-  bne x12, x0, producer_loop
-
-  beq x13, x0, after_minus
-  addi x20, x0, 45
-  ewrite x20
-
-after_minus:
-  addi x14, x14, 1
-  lw x20, x14, 0
-  ewrite x20
-  bne x14, x11, after_minus
-
-  addi x20, x0, 10
-  ewrite x20
+)";
+
+  static constexpr Routine runtime[] = {
+      // Digits are taken from the negated value, as -2^31 has no positive
+      // counterpart, two at a time from the most significant pair down.
+      // x5 steps through the powers of 100, digit_pairs holds the two
+      // characters of every number 0..99.
+      {"print_i32", R"(print_i32:
+  blt x1, x0, print_i32_minus
+  sub x1, x0, x1
+print_i32_digits:
+  addi x2, x0, 100
+  li x3, digit_pairs
+  div x4, x1, x2
+  sub x4, x0, x4
+  addi x5, x0, 1
+  blt x4, x5, print_i32_first
+print_i32_scale:
+  mul x5, x5, x2
+  bge x4, x5, print_i32_scale
+
+print_i32_first:
+  div x6, x1, x5
+  mul x7, x6, x5
+  sub x1, x1, x7
+  add x8, x6, x6
+  sub x8, x3, x8
+  addi x7, x0, -10
+  blt x7, x6, print_i32_ones # no leading zero
+  lw x9, x8, 0
+  ewrite x9
+print_i32_ones:
+  lw x9, x8, 1
+  ewrite x9
+  blt x5, x2, print_i32_end
+
+print_i32_pair:
+  div x5, x5, x2
+  div x6, x1, x5
+  mul x7, x6, x5
+  sub x1, x1, x7
+  add x8, x6, x6
+  sub x8, x3, x8
+  lw x9, x8, 0
+  ewrite x9
+  lw x9, x8, 1
+  ewrite x9
+  bge x5, x2, print_i32_pair
+
+print_i32_end:
+  addi x9, x0, 10
+  ewrite x9
   jalr x0, x31, 0
 
-print_str:
-  lw x10, x1, 0 # load len to x10
+print_i32_minus:
+  addi x2, x0, 45
+  ewrite x2
+  jal x0, print_i32_digits
+
+)", emitDigitPairs},
+      {"print_str", R"(print_str:
+  lw x4, x1, 0 # load len to x4
   addi x1, x1, 1 # move x1 ptr to string begin 
   addi x3, x0, 1 # load 1 to x3
 next_char:
-  beq x10, x0, print_str_end # we are done
+  beq x4, x0, print_str_end # we are done
   lw x2, x1, 0 # load char
   ewrite x2
   addi x1, x1, 1
-  sub x10, x10, x3
+  sub x4, x4, x3
   jal x0, next_char
 print_str_end:
   jalr x0, x31, 0 # return
 
-print_char:
+)"},
+      {"print_char", R"(print_char:
   ewrite x1
   jalr x0, x31, 0 # return
 
-len_str:
+)"},
+      {"len_str", R"(len_str:
   lw x1, x1, 0 # load len to x1
   jalr x0, x31, 0 # return
 
-# END MACROS
+)"},
+  };
 
-)";
+  static constexpr std::string_view runtime_end = R"(# END MACROS
 
-  std::string strings = R"(
-# BEGIN STRINGS
 )";
 
-  std::string res = R"(
-# BEGIN MAIN
-main:
-)";
-  // x1 .. xxx - general
+  // main program and string literals, written out by generate()
+  std::vector<Instr> code;
+  std::vector<Instr> data;
+  std::vector<LabelName> labels;
+  std::vector<std::string> comments;
+
+  // x1 .. x12 - expression temporaries, macros may clobber them
+  // x13 .. x29 - local variables picked by allocateRegisters()
   // x31 ret address
   // x30 arg
+  static constexpr int lastTempReg = 12;
+  static constexpr int firstVarReg = 13;
+  static constexpr int lastVarReg = 29;
   int usedReg = 0;
   int stack_begin = 0x800;
-  std::vector<std::pair<int, std::unordered_map<string, VariableInfo>>> vars = {
-      {stack_begin, {}}};
-
-  std::vector<std::string> breakable;
-  std::vector<std::string> continuable;
+  // temporaries that did not fit into registers, one slot per nesting level,
+  // kept at the top of memory so large programs don't run into them
+  int spill_begin = 0xF000;
+  int spillDepth = 0;
+  // lowest address a variable took, the program image has to end below it
+  int lowestSlot = spill_begin;
+  ScopedTable<VariableInfo> vars;
+  // next free stack slot, one entry per scope of `vars`
+  std::vector<int> frames = {stack_begin};
+
+  // name -> type, filled by the type annotation pass
+  ScopedTable<Type> types;
+
+  std::vector<Label> breakable;
+  std::vector<Label> continuable;
+  // Options::unroll of the program being generated
+  int unroll = 1;
 
   int id = 0;
 };
 
 class Node {
  public:
+  // resolved by annotate(), gen() reads it instead of re-checking the subtree
+  mutable Type type = Type::UNKNOWN;
+
+  // Nodes live in astArena() and are freed all at once with their
+  // Compilation.
+  // Dropping a subtree earlier, as the optimizer does, only runs destructors.
+  static void *operator new(size_t size) {
+    return astArena().allocate(size);
+  }
+  static void operator delete(void *) {}
+
   virtual ~Node() = default;
   virtual void gen() const = 0;
+  // like gen(), but leaves the value in `reg` and no temporary in use
+  virtual void genInto(int reg) const;
   virtual Type typeCheck() const { return Type::UNKNOWN; }
+  Type annotate() const { return type = typeCheck(); }
+  // temporaries needed to evaluate the node (Sethi-Ullman number)
+  virtual int need() const { return 1; }
+  // dump of the subtree to the trace stream
   virtual void print(int indent = 0) const = 0;
-  void printHeader(const int indent = 0, const std::string &id = "",
-                   const std::string &extra = "") const {
-    std::cerr << std::string(indent, ' ') << id;
+  void printHeader(const int indent = 0, std::string_view id = "",
+                   std::string_view extra = "") const {
+    trace() << std::string(indent, ' ') << id;
     if (extra.size()) {
-      std::cerr << "(" << extra << ")";
+      trace() << "(" << extra << ")";
     }
-    std::cerr << std::endl;
+    trace() << '\n';
   }
 };
 
@@ -126,6 +236,7 @@ class NumberNode : public Node {
   int value;
   NumberNode(int val) : value(val) {}
   void gen() const override;
+  void genInto(int reg) const override;
   Type typeCheck() const override { return Type::I32; }
   void print(int indent = 0) const override {
     printHeader(indent, "IntLiteral", std::to_string(value));
@@ -134,39 +245,44 @@ class NumberNode : public Node {
 
 class StringNode : public Node {
  public:
-  string value;
-  StringNode(string val) : value(val) {}
+  Symbol value;  // as written, escapes are resolved by gen()
+  StringNode(Symbol val) : value(val) {}
   void gen() const override;
   Type typeCheck() const override { return Type::STR; }
   void print(int indent = 0) const override {
-    printHeader(indent, "StringLiteral", value);
+    printHeader(indent, "StringLiteral", value.str());
   }
 };
 
 class VariableNode : public Node {
  public:
-  string name;
-  VariableNode(const string &n) : name(n) {}
+  Symbol name;
+  VariableNode(Symbol n) : name(n) {}
   void gen() const override;
+  void genInto(int reg) const override;
   Type typeCheck() const override;
   void print(int indent = 0) const override {
-    printHeader(indent, "Variable", name);
+    printHeader(indent, "Variable", name.str());
   }
 };
 
 class BinaryNode : public Node {
+  mutable int cachedNeed = 0;
+
  public:
-  string op;
+  BinaryOp op;
   std::unique_ptr<Node> left;
   std::unique_ptr<Node> right;
 
-  BinaryNode(const string &o, Node *l, Node *r) : op(o), left(l), right(r) {}
+  BinaryNode(BinaryOp o, Node *l, Node *r) : op(o), left(l), right(r) {}
 
   void gen() const override;
+  void genInto(int reg) const override;
   Type typeCheck() const override;
+  int need() const override;
 
   void print(int indent = 0) const override {
-    printHeader(indent, "BinaryOp", op);
+    printHeader(indent, "BinaryOp", spelling(op));
     left->print(indent + 2);
     right->print(indent + 2);
   }
@@ -174,47 +290,51 @@ class BinaryNode : public Node {
 
 class UnaryNode : public Node {
  public:
-  string op;
+  UnaryOp op;
   std::unique_ptr<Node> right;
 
-  UnaryNode(const string &o, Node *r) : op(o), right(r) {}
+  UnaryNode(UnaryOp o, Node *r) : op(o), right(r) {}
 
   void gen() const override;
   Type typeCheck() const override;
+  int need() const override { return right->need(); }
 
   void print(int indent = 0) const override {
-    printHeader(indent, "UnaryOp", op);
+    printHeader(indent, "UnaryOp", spelling(op));
     right->print(indent + 2);
   }
 };
 
 class AssignNode : public Node {
  public:
-  string name;
+  Symbol name;
   std::unique_ptr<Node> expression;
 
-  AssignNode(const string &n, Node *expr) : name(n), expression(expr) {}
+  AssignNode(Symbol n, Node *expr) : name(n), expression(expr) {}
   void gen() const override;
   Type typeCheck() const override;
   void print(int indent = 0) const override {
-    printHeader(indent, "Assignment", name);
+    printHeader(indent, "Assignment", name.str());
     expression->print(indent + 2);
   }
 };
 
 class VarDeclNode : public Node {
  public:
-  string name;
+  Symbol name;
   Type declaredType;
   std::unique_ptr<Node> expression;
 
-  VarDeclNode(const string &n, Type type, Node *expr)
+  // register chosen by allocateRegisters(), 0 means a stack slot
+  mutable int reg = 0;
+
+  VarDeclNode(Symbol n, Type type, Node *expr)
       : name(n), declaredType(type), expression(expr) {}
 
   void gen() const override;
   Type typeCheck() const override;
   void print(int indent = 0) const override {
-    printHeader(indent, "VarDecl", name);
+    printHeader(indent, "VarDecl", name.str());
     expression->print(indent + 2);
   }
 };
@@ -246,7 +366,8 @@ class IfNode : public Node {
 
 class BlockNode : public Node {
  public:
-  std::vector<std::unique_ptr<Node>> statements;
+  std::vector<std::unique_ptr<Node>, ArenaAllocator<std::unique_ptr<Node>>>
+      statements;
   bool returnsValue;
 
   BlockNode() : returnsValue(false) {}
@@ -272,6 +393,14 @@ class LoopNode : public Node {
   std::unique_ptr<Node> init;
   std::unique_ptr<Node> after_loop;
   std::unique_ptr<Node> block;
+  // factor of a `// #pragma unroll N` comment, 0 when there is none
+  int unroll = 0;
+  // set by optimize() when the iteration count is known, -1 otherwise
+  int64_t tripCount = -1;
+  // whether the body holds no other loop
+  bool innermost = true;
+  // nodes of the body and the step, what an unrolled copy costs
+  int bodySize = 0;
 
   LoopNode(Node *cond, Node *blk, Node *ini = nullptr, Node *after = nullptr)
       : condition(cond), block(blk), init(ini), after_loop(after) {}
@@ -279,8 +408,10 @@ class LoopNode : public Node {
   Type typeCheck() const override;
   void print(int indent = 0) const override {
     printHeader(indent, "WhileLoop");
-    printHeader(indent + 2, "Condition");
-    condition->print(indent + 4);
+    if (condition) {
+      printHeader(indent + 2, "Condition");
+      condition->print(indent + 4);
+    }
     printHeader(indent + 2, "Body");
     block->print(indent + 4);
   }
@@ -288,14 +419,14 @@ class LoopNode : public Node {
 
 class MacroNode : public Node {
  public:
-  std::string name;
+  Symbol name;  // with the `!`
   std::unique_ptr<Node> arg;
 
-  MacroNode(const std::string &n, Node *a) : name(n), arg(a) {}
+  MacroNode(Symbol n, Node *a) : name(n), arg(a) {}
   void gen() const override;
   Type typeCheck() const override;
   void print(int indent = 0) const override {
-    printHeader(indent, "Macro", name);
+    printHeader(indent, "Macro", name.str());
     arg->print(indent + 2);
   }
 };
@@ -316,6 +447,13 @@ class ContinueNode : public Node {
   void print(int indent = 0) const override { printHeader(indent, "Continue"); }
 };
 
-std::string compile(BlockNode *);
+// clears the code generator state of the current Compilation
+void reset();
+void optimize(BlockNode *);
+void annotateTypes(BlockNode *);
+void allocateRegisters(BlockNode *);
+// backend only, expects a tree annotated since the last reset()
+std::string generate(BlockNode *, const Options & = {});
+std::string compile(BlockNode *, const Options & = {});
 
 #endif  // COMPILER_HPP
\ No newline at end of file
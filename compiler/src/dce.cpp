@@ -0,0 +1,71 @@
+#include <vector>
+
+#include "ir.hpp"
+
+// Drops instructions no path from the entry reaches: code after `break`,
+// `continue` and other unconditional jumps, and the side of a branch on a
+// constant condition that is never taken. Labels are kept, they take no
+// space. Runs before branch relaxation, every jump still has a label.
+
+bool removeUnreachable(std::vector<Instr> &code, size_t labelCount) {
+  std::vector<size_t> labels(labelCount, SIZE_MAX);
+  for (size_t i = 0; i < code.size(); ++i) {
+    if (code[i].op == Op::LABEL) labels[code[i].aux] = i;
+  }
+
+  std::vector<bool> reached(code.size());
+  std::vector<size_t> work = {0};
+  auto visit = [&](size_t i) {
+    if (i < code.size() && !reached[i]) {
+      reached[i] = true;
+      work.push_back(i);
+    }
+  };
+  if (!code.empty()) reached[0] = true;
+
+  while (!work.empty()) {
+    const size_t i = work.back();
+    work.pop_back();
+    const auto &ins = code[i];
+    const bool jumps = isBranch(ins.op) || ins.op == Op::JAL;
+    // calls go to runtime routines outside of `code` and come back
+    const bool call = ins.op == Op::JAL && ins.rd != 0;
+    if (jumps && !call && ins.aux != NO_LABEL) visit(labels[ins.aux]);
+
+    const bool fallsThrough = !(ins.op == Op::JAL && ins.rd == 0) &&
+                              ins.op != Op::JALR && ins.op != Op::EBREAK;
+    if (fallsThrough) visit(i + 1);
+  }
+
+  std::vector<Instr> result;
+  result.reserve(code.size());
+  for (size_t i = 0; i < code.size(); ++i) {
+    if (reached[i] || code[i].op == Op::LABEL) result.push_back(code[i]);
+  }
+  const bool changed = result.size() != code.size();
+  code = std::move(result);
+  return changed;
+}
+
+// String literals only referenced from removed code are dropped as well. Each
+// one is a comment, its label and the data words.
+void removeUnusedData(std::vector<Instr> &data, const std::vector<Instr> &code,
+                      size_t labelCount) {
+  std::vector<bool> used(labelCount);
+  for (const auto &ins : code) {
+    if (ins.op == Op::LI && ins.aux != NO_LABEL) used[ins.aux] = true;
+  }
+
+  std::vector<Instr> result;
+  result.reserve(data.size());
+  bool keep = true;
+  for (size_t i = 0; i < data.size(); ++i) {
+    if (data[i].op == Op::COMMENT || data[i].op == Op::LABEL) {
+      size_t j = i;
+      while (j < data.size() && data[j].op != Op::LABEL) ++j;
+      keep = j == data.size() || used[data[j].aux];
+    }
+    if (keep) result.push_back(data[i]);
+  }
+  data = std::move(result);
+}
@@ -0,0 +1,204 @@
+#include "driver.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <deque>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+
+#include "cache.hpp"
+#include "compilation.hpp"
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+double elapsedMs(Clock::time_point start) {
+  return std::chrono::duration<double, std::milli>(Clock::now() - start)
+      .count();
+}
+
+// Runs task(0) .. task(count - 1) on `workers` threads, the calling one
+// included. Every worker starts with a contiguous share of the indices in a
+// deque of its own and works through it from the front. One that runs dry
+// steals from the back of the others, so a few large inputs in one share
+// don't leave the remaining threads idle. Tasks add no new work, once every
+// deque is empty the workers are done.
+class WorkStealingPool {
+ public:
+  explicit WorkStealingPool(unsigned workers)
+      : workers(std::max(1u, workers)) {}
+
+  void run(size_t count, const std::function<void(size_t)> &task) {
+    const size_t n = std::min<size_t>(workers, std::max<size_t>(count, 1));
+    std::vector<Queue> queues(n);
+    for (size_t i = 0; i < count; ++i) {
+      queues[i * n / count].tasks.push_back(i);
+    }
+
+    auto work = [&](size_t self) {
+      size_t index;
+      while (take(queues, self, index)) task(index);
+    };
+    std::vector<std::thread> threads;
+    for (size_t self = 1; self < n; ++self) threads.emplace_back(work, self);
+    work(0);
+    for (auto &thread : threads) thread.join();
+  }
+
+ private:
+  struct Queue {
+    std::mutex lock;
+    std::deque<size_t> tasks;
+  };
+  unsigned workers;
+
+  static bool take(std::vector<Queue> &queues, size_t self, size_t &index) {
+    {
+      auto &own = queues[self];
+      std::lock_guard<std::mutex> guard(own.lock);
+      if (!own.tasks.empty()) {
+        index = own.tasks.front();
+        own.tasks.pop_front();
+        return true;
+      }
+    }
+    for (size_t k = 1; k < queues.size(); ++k) {
+      auto &victim = queues[(self + k) % queues.size()];
+      std::lock_guard<std::mutex> guard(victim.lock);
+      if (!victim.tasks.empty()) {
+        index = victim.tasks.back();
+        victim.tasks.pop_back();
+        return true;
+      }
+    }
+    return false;
+  }
+};
+
+struct FileResult {
+  std::string output;
+  bool ok = false;
+  bool cached = false;
+  // formatted CompilerError, or why the file couldn't be read or written
+  std::string diagnostic;
+  double ms = 0;
+};
+
+std::string outputPath(const std::string &input, const std::string &dir) {
+  std::filesystem::path path(input);
+  path.replace_extension(".s");
+  if (!dir.empty()) path = std::filesystem::path(dir) / path.filename();
+  return path.string();
+}
+
+FileResult compileFile(const std::string &input, const std::string &output,
+                       const Options &options, Cache *cache) {
+  FileResult file;
+  file.output = output;
+  const auto start = Clock::now();
+  Compilation unit(input);
+  if (!unit.source.open(input.c_str())) {
+    file.diagnostic = "error: cannot read " + input + "\n";
+  } else {
+    const Result result = cache ? cache->compile(unit, options, &file.cached)
+                                : unit.run(options);
+    if (!result.ok) {
+      file.diagnostic = result.error;
+    } else if (FILE *out = std::fopen(output.c_str(), "wb")) {
+      // the same bytes `sus input > output` writes
+      const bool written =
+          std::fwrite(result.assembly.data(), 1, result.assembly.size(),
+                      out) == result.assembly.size() &&
+          std::fputc('\n', out) != EOF;
+      file.ok = std::fclose(out) == 0 && written;
+      if (!file.ok) file.diagnostic = "error: cannot write " + output + "\n";
+    } else {
+      file.diagnostic = "error: cannot write " + output + "\n";
+    }
+  }
+  file.ms = elapsedMs(start);
+  return file;
+}
+
+}  // namespace
+
+bool readManifest(const char *manifest, std::vector<std::string> &inputs) {
+  std::ifstream in(manifest);
+  if (!in) return false;
+  std::string line;
+  while (std::getline(in, line)) {
+    if (!line.empty() && line.back() == '\r') line.pop_back();
+    if (line.empty() || line[0] == '#') continue;
+    inputs.push_back(line);
+  }
+  return true;
+}
+
+int compileBatch(const Batch &batch, const Options &options) {
+  const unsigned jobs =
+      batch.jobs ? batch.jobs
+                 : std::max(1u, std::thread::hardware_concurrency());
+  // -o puts every .s file in one directory, a.rs and lib/a.rs would both
+  // write a.s there. Compiling either of them would be wasted.
+  std::vector<std::string> outputs;
+  std::unordered_map<std::string, size_t> writers;
+  for (size_t i = 0; i < batch.inputs.size(); ++i) {
+    outputs.push_back(outputPath(batch.inputs[i], batch.outputDir));
+    std::error_code error;
+    auto path = std::filesystem::absolute(outputs[i], error);
+    if (error) path = outputs[i];
+    const auto [first, added] =
+        writers.emplace(path.lexically_normal().string(), i);
+    if (!added) {
+      std::fprintf(stderr, "error: %s and %s both compile to %s\n",
+                   batch.inputs[first->second].c_str(),
+                   batch.inputs[i].c_str(), outputs[i].c_str());
+      return 1;
+    }
+  }
+  if (!batch.outputDir.empty()) {
+    std::error_code error;
+    std::filesystem::create_directories(batch.outputDir, error);
+    if (error) {
+      std::fprintf(stderr, "error: cannot create %s: %s\n",
+                   batch.outputDir.c_str(), error.message().c_str());
+      return 1;
+    }
+  }
+
+  const auto start = Clock::now();
+  std::vector<FileResult> files(batch.inputs.size());
+  WorkStealingPool(jobs).run(files.size(), [&](size_t i) {
+    files[i] = compileFile(batch.inputs[i], outputs[i], options, batch.cache);
+  });
+  const double wall = elapsedMs(start);
+
+  // in input order once everything is done, so diagnostics don't interleave
+  size_t failed = 0;
+  size_t cached = 0;
+  double busy = 0;
+  for (size_t i = 0; i < files.size(); ++i) {
+    const auto &file = files[i];
+    busy += file.ms;
+    if (file.ok) {
+      cached += file.cached;
+      std::printf("%-6s %9.2f ms  %s -> %s\n", file.cached ? "cached" : "ok",
+                  file.ms, batch.inputs[i].c_str(), file.output.c_str());
+    } else {
+      ++failed;
+      std::printf("FAILED %9.2f ms  %s\n", file.ms, batch.inputs[i].c_str());
+      std::fflush(stdout);
+      std::fputs(file.diagnostic.c_str(), stderr);
+    }
+  }
+  std::printf("%zu files, %zu failed, %zu cached, %u jobs: %.2f ms wall, "
+              "%.2f ms over all files\n",
+              files.size(), failed, cached, jobs, wall, busy);
+  return failed ? 1 : 0;
+}
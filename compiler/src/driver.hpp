@@ -0,0 +1,32 @@
+#ifndef DRIVER_HPP
+#define DRIVER_HPP
+
+#include <string>
+#include <vector>
+
+#include "sus.hpp"
+
+class Cache;
+
+// Batch mode of the command line tool, `sus -j N [-o dir] a.rs b.rs @list`
+struct Batch {
+  std::vector<std::string> inputs;
+  // where the .s files go, next to their inputs when empty
+  std::string outputDir;
+  // worker threads, 0 for one per core
+  unsigned jobs = 0;
+  // consulted before compiling when set, see --cache
+  Cache *cache = nullptr;
+};
+
+// Compiles every input into a .s file of its own, in parallel. Prints a line
+// per input with its time, the diagnostics of the failed ones on stderr and
+// the totals at the end. Returns the exit status, 0 if every input compiled.
+// Nothing is compiled when two inputs would write the same .s file.
+int compileBatch(const Batch &batch, const Options &options);
+
+// Appends the paths listed in `manifest`, one per line. Blank lines and
+// lines starting with '#' are skipped. False when it can't be read.
+bool readManifest(const char *manifest, std::vector<std::string> &inputs);
+
+#endif  // DRIVER_HPP
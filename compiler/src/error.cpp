@@ -1,32 +1,9 @@
 #include "error.hpp"
+#include "compilation.hpp"
 #include "compiler.hpp"
-#include <fstream>
-#include <sstream>
 
-// Initialize current location global variable
-SourceLocation current_location;
-
-// Store source code for error reporting
-std::vector<std::string> source_lines;
-
-void load_source_file(const std::string& filename) {
-    source_lines.clear();
-    std::ifstream file(filename);
-    if (file.is_open()) {
-        std::string line;
-        while (std::getline(file, line)) {
-            source_lines.push_back(line);
-        }
-    }
-}
-
-void load_source_from_string(const std::string& source) {
-    source_lines.clear();
-    std::istringstream stream(source);
-    std::string line;
-    while (std::getline(stream, line)) {
-        source_lines.push_back(line);
-    }
+const SourceLocation& currentLocation() {
+    return Compilation::current().location;
 }
 
 CompilerError createError(ErrorType type, const std::string& message, const SourceLocation& location) {
@@ -34,9 +11,8 @@ CompilerError createError(ErrorType type, const std::string& message, const Sour
 }
 
 void reportError(ErrorType type, const std::string& message, const SourceLocation& location) {
-    CompilerError error(type, message, location);
-    error.report();
-    exit(1);  // Exit the program on error
+    // ends the compilation, Compilation::run() turns it into the Result
+    throw CompilerError(type, message, location);
 }
 
 void typeError(const std::string& message, const SourceLocation& location) {
@@ -48,7 +24,8 @@ void nameError(const std::string& message, const SourceLocation& location) {
 }
 
 void syntaxError(const std::string& message, const SourceLocation& location) {
-    reportError(ErrorType::SYNTAX_ERROR, message, location);
+    auto& error = Compilation::current().error;
+    if (!error) error.emplace(ErrorType::SYNTAX_ERROR, message, location);
 }
 
 std::string typeToString(int type) {
@@ -63,10 +40,3 @@ std::string typeToString(int type) {
             return "invalid_type";
     }
 }
-
-// Update location for error reporting
-void updateLocation(int line, int column, const std::string& filename) {
-    current_location.line = line;
-    current_location.column = column;
-    current_location.filename = filename;
-} 
\ No newline at end of file
@@ -5,7 +5,8 @@
 #include <string>
 #include <sstream>
 #include <vector>
-#include <fstream>
+
+#include "source.hpp"
 
 enum class ErrorType {
     SYNTAX_ERROR,
@@ -23,16 +24,8 @@ struct SourceLocation {
         : line(l), column(c), filename(f) {}
 };
 
-extern SourceLocation current_location;
-
-// Store the source code for displaying in error messages
-extern std::vector<std::string> source_lines;
-
-// Read source file into memory
-void load_source_file(const std::string& filename);
-
-// Load from string (for tests)
-void load_source_from_string(const std::string& source);
+// where the scanner of the current Compilation is
+const SourceLocation& currentLocation();
 
 class CompilerError {
 private:
@@ -41,10 +34,13 @@ private:
     SourceLocation primary_location;
 
 public:
-    CompilerError(ErrorType t, const std::string& msg, const SourceLocation& loc = current_location)
+    CompilerError(ErrorType t, const std::string& msg, const SourceLocation& loc = currentLocation())
         : type(t), message(msg), primary_location(loc) {}
     
-    std::string formatError() const {
+    const SourceLocation& location() const { return primary_location; }
+
+    // `source` is the program the error was found in
+    std::string formatError(const Source& source) const {
         std::stringstream ss;
         
         switch (type) {
@@ -66,7 +62,7 @@ public:
         ss << " " << message << std::endl;
         
         // Add primary location with code context
-        if (primary_location.line > 0 && !source_lines.empty()) {
+        if (primary_location.line > 0 && source.lineCount() > 0) {
             // File location
             ss << " --> ";
             if (!primary_location.filename.empty()) {
@@ -76,19 +72,19 @@ public:
             
             // Show 2 lines before and after for context
             int context_start = std::max(1, primary_location.line - 2);
-            int context_end = std::min(static_cast<int>(source_lines.size()), primary_location.line + 2);
+            int context_end = std::min(source.lineCount(), primary_location.line + 2);
             
             // Calculate width for line numbers
             int line_num_width = std::to_string(context_end).length();
             
             // Display context
             for (int i = context_start; i <= context_end; i++) {
-                if (i - 1 < source_lines.size()) {
+                if (i <= source.lineCount()) {
                     std::string padding(line_num_width - std::to_string(i).length(), ' ');
                     
                     // Mark the error line
                     if (i == primary_location.line) {
-                        ss << " " << padding << i << " | " << source_lines[i - 1] << std::endl;
+                        ss << " " << padding << i << " | " << source.line(i) << std::endl;
                         
                         // Add carets under the error position
                         ss << " " << std::string(line_num_width, ' ') << " | ";
@@ -107,7 +103,7 @@ public:
                         ss << " ";
                         ss << "" << message << "" << std::endl;
                     } else {
-                        ss << " " << padding << i << " | " << source_lines[i - 1] << std::endl;
+                        ss << " " << padding << i << " | " << source.line(i) << std::endl;
                     }
                 }
             }
@@ -115,21 +111,17 @@ public:
         
         return ss.str();
     }
-    
-    void report() const {
-        std::cerr << formatError();
-    }
 };
 
-// Global error functions
-void reportError(ErrorType type, const std::string& message, const SourceLocation& location = current_location);
-void typeError(const std::string& message, const SourceLocation& location = current_location);
-void nameError(const std::string& message, const SourceLocation& location = current_location);
-void syntaxError(const std::string& message, const SourceLocation& location = current_location);
-
-CompilerError createError(ErrorType type, const std::string& message, const SourceLocation& location = current_location);
+// Global error functions. They throw the CompilerError, except syntaxError(),
+// which only records the first one in the current Compilation: the parser
+// has to unwind on its own.
+[[noreturn]] void reportError(ErrorType type, const std::string& message, const SourceLocation& location = currentLocation());
+[[noreturn]] void typeError(const std::string& message, const SourceLocation& location = currentLocation());
+[[noreturn]] void nameError(const std::string& message, const SourceLocation& location = currentLocation());
+void syntaxError(const std::string& message, const SourceLocation& location = currentLocation());
 
-void updateLocation(int line, int column, const std::string& filename);
+CompilerError createError(ErrorType type, const std::string& message, const SourceLocation& location = currentLocation());
 
 std::string typeToString(int type);
 
@@ -0,0 +1,198 @@
+#include "ir.hpp"
+
+#include <charconv>
+
+namespace {
+
+constexpr const char *mnemonics[] = {
+    "lui",  "jal",  "jalr", "beq",    "bne",   "blt",    "bge", "lw",
+    "sw",   "addi", "xori", "add",    "sub",   "sll",    "slt", "seq",
+    "sne",  "sge",  "xor",  "srl",    "sra",   "or",     "and", "mul",
+    "div",  "rem",  "ebreak", "eread", "ewrite", "li",   "data",
+};
+
+bool fitsImm12(int64_t value) { return -2048 <= value && value < 2048; }
+
+}  // namespace
+
+bool isBranch(Op op) {
+  return op == Op::BEQ || op == Op::BNE || op == Op::BLT || op == Op::BGE;
+}
+
+Op invertBranch(Op op) {
+  switch (op) {
+    case Op::BEQ: return Op::BNE;
+    case Op::BNE: return Op::BEQ;
+    case Op::BLT: return Op::BGE;
+    case Op::BGE: return Op::BLT;
+    default: return op;
+  }
+}
+
+int instrSize(const Instr &instr) {
+  switch (instr.op) {
+    case Op::LABEL:
+    case Op::COMMENT:
+      return 0;
+    case Op::DATA:
+      return instr.aux;
+    case Op::LI:
+      if (instr.aux != NO_LABEL) return 2;
+      if (fitsImm12(instr.imm)) return 1;
+      return (instr.imm & 0xFFF) == 0 ? 1 : 2;
+    default:
+      return 1;
+  }
+}
+
+void relaxBranches(std::vector<Instr> &code, size_t labelCount) {
+  std::vector<bool> relaxed(code.size());
+  std::vector<int> labels(labelCount);
+  std::vector<int> positions(code.size());
+  bool any = false;
+
+  for (bool changed = true; changed;) {
+    changed = false;
+    int pos = 0;
+    for (size_t i = 0; i < code.size(); ++i) {
+      positions[i] = pos;
+      if (code[i].op == Op::LABEL) labels[code[i].aux] = pos;
+      pos += relaxed[i] ? 2 : instrSize(code[i]);
+    }
+    for (size_t i = 0; i < code.size(); ++i) {
+      if (relaxed[i] || !isBranch(code[i].op) || code[i].aux == NO_LABEL) {
+        continue;
+      }
+      if (!fitsImm12(labels[code[i].aux] - positions[i] - 1)) {
+        relaxed[i] = changed = any = true;
+      }
+    }
+  }
+  if (!any) return;
+
+  std::vector<Instr> result;
+  result.reserve(code.size() + code.size() / 8);
+  for (size_t i = 0; i < code.size(); ++i) {
+    if (!relaxed[i]) {
+      result.push_back(code[i]);
+      continue;
+    }
+    // blt x1, x2, label -> bge x1, x2, 1; jal x0, label
+    Instr skip = code[i];
+    skip.op = invertBranch(skip.op);
+    skip.imm = 1;
+    skip.aux = NO_LABEL;
+    result.push_back(skip);
+    result.push_back({Op::JAL, 0, 0, 0, 0, code[i].aux});
+  }
+  code = std::move(result);
+}
+
+void AsmWriter::write(const std::vector<Instr> &code) {
+  for (const auto &i : code) instr(i);
+}
+
+void AsmWriter::reg(int r) {
+  out += 'x';
+  num(r);
+}
+
+void AsmWriter::num(int64_t value) {
+  char buf[24];
+  const auto res = std::to_chars(buf, buf + sizeof(buf), value);
+  out.append(buf, res.ptr);
+}
+
+void AsmWriter::label(Label l) {
+  out += labels[l].prefix;
+  if (labels[l].id >= 0) num(labels[l].id);
+}
+
+void AsmWriter::instr(const Instr &i) {
+  if (i.op == Op::LABEL) {
+    label(i.aux);
+    out += ":\n";
+    return;
+  }
+  out += "  ";
+  if (i.op == Op::COMMENT) {
+    out += comments[i.aux];
+    out += '\n';
+    return;
+  }
+  out += mnemonics[static_cast<int>(i.op)];
+
+  switch (i.op) {
+    case Op::EBREAK:
+      break;
+    case Op::EREAD:
+      out += ' ';
+      reg(i.rd);
+      break;
+    case Op::EWRITE:
+      out += ' ';
+      reg(i.rs1);
+      break;
+    case Op::DATA:
+      out += ' ';
+      num(i.imm);
+      out += " * ";
+      num(i.aux);
+      break;
+    case Op::LUI:
+    case Op::JAL:
+    case Op::LI:
+      out += ' ';
+      reg(i.rd);
+      out += ", ";
+      if (i.aux != NO_LABEL) {
+        label(i.aux);
+      } else {
+        num(i.imm);
+      }
+      break;
+    case Op::BEQ:
+    case Op::BNE:
+    case Op::BLT:
+    case Op::BGE:
+      out += ' ';
+      reg(i.rs1);
+      out += ", ";
+      reg(i.rs2);
+      out += ", ";
+      if (i.aux != NO_LABEL) {
+        label(i.aux);
+      } else {
+        num(i.imm);
+      }
+      break;
+    case Op::SW:
+      out += ' ';
+      reg(i.rs1);
+      out += ", ";
+      num(i.imm);
+      out += ", ";
+      reg(i.rs2);
+      break;
+    case Op::LW:
+    case Op::JALR:
+    case Op::ADDI:
+    case Op::XORI:
+      out += ' ';
+      reg(i.rd);
+      out += ", ";
+      reg(i.rs1);
+      out += ", ";
+      num(i.imm);
+      break;
+    default:
+      out += ' ';
+      reg(i.rd);
+      out += ", ";
+      reg(i.rs1);
+      out += ", ";
+      reg(i.rs2);
+      break;
+  }
+  out += '\n';
+}
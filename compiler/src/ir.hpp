@@ -0,0 +1,109 @@
+#ifndef IR_HPP
+#define IR_HPP
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Instructions of the target machine as codegen produces them. They are kept
+// in flat vectors and only turned into assembler text by AsmWriter once the
+// whole program is generated.
+
+enum class Op : uint8_t {
+  LUI,
+  JAL,
+  JALR,
+  BEQ,
+  BNE,
+  BLT,
+  BGE,
+  LW,
+  SW,
+  ADDI,
+  XORI,
+  ADD,
+  SUB,
+  SLL,
+  SLT,
+  SEQ,
+  SNE,
+  SGE,
+  XOR,
+  SRL,
+  SRA,
+  OR,
+  AND,
+  MUL,
+  DIV,
+  REM,
+  EBREAK,
+  EREAD,
+  EWRITE,
+  // pseudo instructions of the assembler
+  LI,
+  DATA,
+  // not emitted to memory
+  LABEL,
+  COMMENT,
+};
+
+// Printed as `prefix` followed by `id`, or just `prefix` when id < 0
+struct LabelName {
+  const char *prefix;
+  int id;
+};
+
+using Label = int32_t;  // index into the label table
+constexpr Label NO_LABEL = -1;
+
+struct Instr {
+  Op op;
+  uint8_t rd = 0;
+  uint8_t rs1 = 0;
+  uint8_t rs2 = 0;
+  int32_t imm = 0;
+  // target of jumps, branches and `li`, the label a LABEL defines. DATA keeps
+  // its repeat count here and COMMENT the index of its text.
+  int32_t aux = NO_LABEL;
+};
+
+bool isBranch(Op op);
+Op invertBranch(Op op);
+// memory words the assembler emits for the instruction
+int instrSize(const Instr &instr);
+
+// Branches only reach +-2K words. The ones that don't are turned into an
+// inverted branch over a `jal`, repeated until nothing grows any more.
+void relaxBranches(std::vector<Instr> &code, size_t labelCount);
+
+// Local clean-ups of the generated code, see peephole.cpp
+void peephole(std::vector<Instr> &code, size_t labelCount);
+// Dead code elimination, see dce.cpp. Returns whether anything was removed.
+bool removeUnreachable(std::vector<Instr> &code, size_t labelCount);
+void removeUnusedData(std::vector<Instr> &data, const std::vector<Instr> &code,
+                      size_t labelCount);
+
+class AsmWriter {
+ public:
+  AsmWriter(const std::vector<LabelName> &labels,
+            const std::vector<std::string> &comments)
+      : labels(labels), comments(comments) {}
+
+  void reserve(size_t bytes) { out.reserve(bytes); }
+  void text(std::string_view s) { out += s; }
+  void write(const std::vector<Instr> &code);
+  std::string take() { return std::move(out); }
+
+ private:
+  const std::vector<LabelName> &labels;
+  const std::vector<std::string> &comments;
+  std::string out;
+
+  void instr(const Instr &instr);
+  void reg(int r);
+  void num(int64_t value);
+  void label(Label l);
+};
+
+#endif  // IR_HPP
@@ -0,0 +1,155 @@
+// Command line front end of the compiler, everything else is libsus.a
+
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+#include "cache.hpp"
+#include "compilation.hpp"
+#include "driver.hpp"
+#include "trace.hpp"
+
+#ifdef __EMSCRIPTEN__
+bool FORCE_STDIN = true;
+#else
+bool FORCE_STDIN = false;
+#endif
+
+int main(int argc, char **argv) {
+  // sus [-O<level>] [--unroll=<factor>] [--trace=lex,ast,gen] [file]
+  // sus [-O<level>] [--unroll=<factor>] -j <jobs> [-o <dir>] files @list
+  // either one with [--cache=<dir> [--cache-size=<bytes>[K|M|G]]], and
+  // sus --cache=<dir> --cache-stats
+  Options options;
+  Batch batch;
+  bool batchMode = false;
+  bool traced = false;
+  const char *cacheDir = nullptr;
+  uint64_t cacheSize = Cache::defaultLimit;
+  bool cacheStats = false;
+  const char *path = nullptr;
+  for (int i = 1; i < argc; ++i) {
+    if (argv[i][0] == '-' && argv[i][1] == 'O') {
+      options.optLevel = argv[i][2] ? atoi(argv[i] + 2) : 1;
+    } else if (strncmp(argv[i], "--unroll=", 9) == 0) {
+      const long factor = strtol(argv[i] + 9, nullptr, 10);
+      options.unroll =
+          static_cast<int>(std::clamp(factor, 1L, long{Options::maxUnroll}));
+    } else if (strncmp(argv[i], "--trace=", 8) == 0) {
+      if (!enableTrace(argv[i] + 8)) {
+        fprintf(stderr, "unknown channel in %s, use lex, ast or gen\n",
+                argv[i]);
+        return 1;
+      }
+      traced = true;
+    } else if (strncmp(argv[i], "--cache=", 8) == 0) {
+      cacheDir = argv[i] + 8;
+    } else if (strncmp(argv[i], "--cache-size=", 13) == 0) {
+      cacheSize = parseSize(argv[i] + 13);
+      if (!cacheSize) {
+        fprintf(stderr, "invalid size in %s\n", argv[i]);
+        return 1;
+      }
+    } else if (strcmp(argv[i], "--cache-stats") == 0) {
+      cacheStats = true;
+    } else if (strncmp(argv[i], "-j", 2) == 0) {
+      // `-j` as the last argument leaves it at one job per core
+      if (argv[i][2] || i + 1 < argc) {
+        const char *jobs = argv[i][2] ? argv[i] + 2 : argv[++i];
+        char *end;
+        const long count = strtol(jobs, &end, 10);
+        if (!isdigit(static_cast<unsigned char>(*jobs)) || *end ||
+            count < 1 || count > 1024) {
+          fprintf(stderr, "invalid number of jobs %s, use 1 to 1024\n",
+                  jobs);
+          return 1;
+        }
+        batch.jobs = static_cast<unsigned>(count);
+      }
+      batchMode = true;
+    } else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+      batch.outputDir = argv[++i];
+      batchMode = true;
+    } else if (argv[i][0] == '@') {
+      if (!readManifest(argv[i] + 1, batch.inputs)) {
+        fprintf(stderr, "cannot read the list of files %s\n", argv[i] + 1);
+        return 1;
+      }
+      batchMode = true;
+    } else {
+      path = argv[i];
+      batch.inputs.push_back(path);
+    }
+  }
+
+  Cache cache;
+  if (cacheDir && !cache.open(cacheDir, cacheSize)) {
+    fprintf(stderr, "cannot create the cache directory %s\n", cacheDir);
+    return 1;
+  }
+  if (cacheStats) {
+    if (!cacheDir) {
+      fprintf(stderr, "--cache-stats needs --cache=<dir>\n");
+      return 1;
+    }
+    const auto stats = cache.stats();
+    const auto lookups = stats.hits + stats.misses;
+    printf("hits       %llu (%.1f%%)\nmisses     %llu\nevictions  %llu\n"
+           "bytes      %llu",
+           static_cast<unsigned long long>(stats.hits),
+           lookups ? 100.0 * stats.hits / lookups : 0.0,
+           static_cast<unsigned long long>(stats.misses),
+           static_cast<unsigned long long>(stats.evictions),
+           static_cast<unsigned long long>(stats.bytes));
+    // the limit the directory was last kept to, which runs with another
+    // --cache-size may have changed
+    if (stats.limit) {
+      printf(" of %llu", static_cast<unsigned long long>(stats.limit));
+    }
+    printf("\n");
+    return 0;
+  }
+  if (cacheDir) batch.cache = &cache;
+
+  if (batchMode || batch.inputs.size() > 1) {
+    // the trace is one stream, output of parallel compilations would mix
+    if (traced && batch.jobs != 1) {
+      fprintf(stderr, "--trace needs -j 1\n");
+      return 1;
+    }
+    const int status = compileBatch(batch, options);
+    cache.flush();
+    return status;
+  }
+
+  const auto f = FORCE_STDIN ? "/input.txt" : path;
+
+  // the program is read once, flex scans it in place and error messages
+  // quote lines from the same buffer
+  Compilation unit(f ? f : "<stdin>");
+  if (f) {
+    if (!unit.source.open(f)) {
+      printf("syntax: %s [-O<level>] [--unroll=<factor>] "
+             "[--trace=lex,ast,gen] filename\n",
+             argv[0]);
+      return 1;
+    }
+  } else if (!unit.source.read(stdin)) {
+    std::cerr << "Error: Could not read the input" << std::endl;
+    return 1;
+  }
+
+  // a hit skips the whole pipeline, --trace shows nothing then
+  const Result result =
+      cacheDir ? cache.compile(unit, options) : unit.run(options);
+  cache.flush();
+  if (!result.ok) {
+    std::cerr << result.error;
+    return 1;
+  }
+  std::cout << result.assembly << std::endl;
+  return 0;
+}
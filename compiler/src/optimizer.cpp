@@ -0,0 +1,923 @@
+#include <bit>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "compiler.hpp"
+
+// AST optimizations that run between parsing and compile():
+//  - folding of constant subtrees with the machine's 32-bit semantics
+//  - algebraic identities (x + 0, x * 1, x * 0, x / 1) and reassociation of
+//    constant chains like x * 3 * 1000
+//  - propagation of `let` bindings that are initialized with a constant and
+//    never assigned again. Inside loops a binding is only substituted where
+//    its parent folds away, elsewhere it stays in its register since a
+//    literal operand costs an extra `li` on every iteration. Bindings left
+//    without uses are dropped.
+//  - strength reduction: in `for let i = a; ...; i += s` a product i * c with
+//    a literal c becomes a variable that starts at a * c and steps by s * c
+//  - x * 2^k -> x << k once everything else has been folded
+//  - loop-invariant code motion: expressions whose variables a loop never
+//    writes are computed once before it into a fresh variable, literals that
+//    need their own instruction are loaded there too
+
+namespace {
+
+using Slot = std::unique_ptr<Node>;
+
+template <typename T>
+T *as(const Slot &slot) {
+  return dynamic_cast<T *>(slot.get());
+}
+
+bool isNumber(const Slot &slot) { return as<NumberNode>(slot) != nullptr; }
+
+int numberValue(const Slot &slot) { return as<NumberNode>(slot)->value; }
+
+// Result of `a op b` as computed by the machine, false if it can't be folded
+bool evaluate(BinaryOp op, int a, int b, int &res) {
+  const uint32_t ua = a;
+  const uint32_t ub = b;
+  switch (op) {
+    case BinaryOp::ADD: res = ua + ub; return true;
+    case BinaryOp::SUB: res = ua - ub; return true;
+    case BinaryOp::MUL: res = ua * ub; return true;
+    case BinaryOp::XOR: res = ua ^ ub; return true;
+    case BinaryOp::AND: res = a && b; return true;
+    case BinaryOp::OR: res = a || b; return true;
+    case BinaryOp::SHL: res = ua << (ub & 31); return true;
+    case BinaryOp::LT: res = a < b; return true;
+    case BinaryOp::GT: res = a > b; return true;
+    case BinaryOp::LE: res = a <= b; return true;
+    case BinaryOp::GE: res = a >= b; return true;
+    case BinaryOp::EQ: res = a == b; return true;
+    case BinaryOp::NE: res = a != b; return true;
+    case BinaryOp::DIV:
+    case BinaryOp::REM:
+      if (b == 0 || (b == -1 && a == INT32_MIN)) return false;
+      res = op == BinaryOp::DIV ? a / b : a % b;
+      return true;
+    default:
+      return false;
+  }
+}
+
+bool isPowerOfTwo(int v) { return v > 1 && (v & (v - 1)) == 0; }
+
+bool isRelation(BinaryOp op) {
+  return op == BinaryOp::LT || op == BinaryOp::GT || op == BinaryOp::LE ||
+         op == BinaryOp::GE || op == BinaryOp::EQ || op == BinaryOp::NE;
+}
+
+// Whether codegen spends an instruction on every evaluation to get literal
+// `value` into a register, as operand of `op`. Only the forms genImmediate()
+// folds into addi and xori take it as is: ADD and XOR on either side, and
+// SUB on the right as an addi of -value.
+bool needsRegister(BinaryOp op, int value, bool right) {
+  if (value == 0) return false;
+  if (op == BinaryOp::ADD || op == BinaryOp::XOR) {
+    return value < -2048 || value >= 2048;
+  }
+  if (op == BinaryOp::SUB && right) return value <= -2048 || value > 2048;
+  return true;
+}
+
+// Names a subtree declares or assigns
+void writtenNames(const Node *node, std::unordered_set<Symbol> &names) {
+  if (!node) return;
+
+  if (auto block = dynamic_cast<const BlockNode *>(node)) {
+    for (const auto &stmt : block->statements) writtenNames(stmt.get(), names);
+  } else if (auto decl = dynamic_cast<const VarDeclNode *>(node)) {
+    names.insert(decl->name);
+  } else if (auto assign = dynamic_cast<const AssignNode *>(node)) {
+    names.insert(assign->name);
+  } else if (auto branch = dynamic_cast<const IfNode *>(node)) {
+    writtenNames(branch->thenBlock.get(), names);
+    writtenNames(branch->elseBlock.get(), names);
+  } else if (auto loop = dynamic_cast<const LoopNode *>(node)) {
+    writtenNames(loop->init.get(), names);
+    writtenNames(loop->block.get(), names);
+    writtenNames(loop->after_loop.get(), names);
+  }
+}
+
+// Nodes in the subtree, a rough measure of the code it turns into
+int nodeCount(const Node *node) {
+  if (!node) return 0;
+
+  int count = 1;
+  if (auto block = dynamic_cast<const BlockNode *>(node)) {
+    for (const auto &stmt : block->statements) count += nodeCount(stmt.get());
+  } else if (auto decl = dynamic_cast<const VarDeclNode *>(node)) {
+    count += nodeCount(decl->expression.get());
+  } else if (auto assign = dynamic_cast<const AssignNode *>(node)) {
+    count += nodeCount(assign->expression.get());
+  } else if (auto bin = dynamic_cast<const BinaryNode *>(node)) {
+    count += nodeCount(bin->left.get()) + nodeCount(bin->right.get());
+  } else if (auto unary = dynamic_cast<const UnaryNode *>(node)) {
+    count += nodeCount(unary->right.get());
+  } else if (auto macro = dynamic_cast<const MacroNode *>(node)) {
+    count += nodeCount(macro->arg.get());
+  } else if (auto branch = dynamic_cast<const IfNode *>(node)) {
+    count += nodeCount(branch->condition.get()) +
+             nodeCount(branch->thenBlock.get()) +
+             nodeCount(branch->elseBlock.get());
+  } else if (auto loop = dynamic_cast<const LoopNode *>(node)) {
+    count += nodeCount(loop->init.get()) + nodeCount(loop->condition.get()) +
+             nodeCount(loop->block.get()) + nodeCount(loop->after_loop.get());
+  }
+  return count;
+}
+
+// Counter of a for loop and the products with it
+struct Induction {
+  Symbol name;
+  const Node *initial;
+  int step;
+  struct Product {
+    int operands = 0;  // uses as an operand of another operation
+    int values = 0;    // uses as the whole value of a binding or assignment
+  };
+  std::map<int, Product> products;  // by literal factor
+  int otherUses = 0;                // reads of the counter outside products
+  std::map<int, Symbol> derived;    // factor c -> variable holding i * c
+};
+
+// Declarations computed in front of a loop
+struct Preheader {
+  std::unordered_set<Symbol> variant;  // written somewhere in the loop
+  std::vector<Slot> decls;
+  std::unordered_map<int, Symbol> literals;
+};
+
+struct Binding {
+  const VarDeclNode *decl;
+  bool isInt;
+  int loopDepth;
+};
+
+class Optimizer {
+ public:
+  // Pass 1: find bindings that are written after their declaration
+  void collect(const Node *node) {
+    if (!node) return;
+
+    if (auto block = dynamic_cast<const BlockNode *>(node)) {
+      scopes.enter();
+      for (const auto &stmt : block->statements) collect(stmt.get());
+      scopes.exit();
+    } else if (auto decl = dynamic_cast<const VarDeclNode *>(node)) {
+      collect(decl->expression.get());
+      declare(decl, false);
+    } else if (auto assign = dynamic_cast<const AssignNode *>(node)) {
+      collect(assign->expression.get());
+      if (auto binding = lookup(assign->name)) mutated.insert(binding->decl);
+    } else if (auto bin = dynamic_cast<const BinaryNode *>(node)) {
+      collect(bin->left.get());
+      collect(bin->right.get());
+    } else if (auto unary = dynamic_cast<const UnaryNode *>(node)) {
+      collect(unary->right.get());
+    } else if (auto macro = dynamic_cast<const MacroNode *>(node)) {
+      collect(macro->arg.get());
+    } else if (auto branch = dynamic_cast<const IfNode *>(node)) {
+      collect(branch->condition.get());
+      collect(branch->thenBlock.get());
+      collect(branch->elseBlock.get());
+    } else if (auto loop = dynamic_cast<const LoopNode *>(node)) {
+      scopes.enter();
+      collect(loop->init.get());
+      collect(loop->condition.get());
+      collect(loop->block.get());
+      collect(loop->after_loop.get());
+      scopes.exit();
+    }
+  }
+
+  // Pass 2: fold and propagate, rewriting the tree in place
+  void fold(Slot &slot) {
+    if (!slot) return;
+
+    if (auto block = as<BlockNode>(slot)) {
+      scopes.enter();
+      for (auto &stmt : block->statements) fold(stmt);
+      scopes.exit();
+      std::erase_if(block->statements, [&](const Slot &stmt) {
+        auto decl = as<VarDeclNode>(stmt);
+        return decl && unused(decl);
+      });
+    } else if (auto decl = as<VarDeclNode>(slot)) {
+      fold(decl->expression);
+      const bool isInt = declaredInt(decl);
+      if (isInt && isNumber(decl->expression) && !mutated.count(decl)) {
+        constants[decl] = numberValue(decl->expression);
+      }
+      declare(decl, isInt);
+    } else if (auto assign = as<AssignNode>(slot)) {
+      fold(assign->expression);
+    } else if (auto var = as<VariableNode>(slot)) {
+      auto binding = lookup(var->name);
+      if (binding && constants.count(binding->decl)) {
+        if (binding->loopDepth == loopDepth) {
+          slot = std::make_unique<NumberNode>(constants.at(binding->decl));
+        } else {
+          ++uses[binding->decl];
+        }
+      }
+    } else if (auto unary = as<UnaryNode>(slot)) {
+      fold(unary->right);
+      if (isNumber(unary->right)) {
+        const int v = numberValue(unary->right);
+        const int res =
+            unary->op == UnaryOp::NEG ? static_cast<int>(0u - v) : v == 0;
+        slot = std::make_unique<NumberNode>(res);
+      }
+    } else if (auto bin = as<BinaryNode>(slot)) {
+      fold(bin->left);
+      fold(bin->right);
+      simplify(slot);
+    } else if (auto macro = as<MacroNode>(slot)) {
+      fold(macro->arg);
+    } else if (auto branch = as<IfNode>(slot)) {
+      fold(branch->condition);
+      fold(branch->thenBlock);
+      fold(branch->elseBlock);
+      // an empty else only costs the jump over it
+      auto elseBlock = as<BlockNode>(branch->elseBlock);
+      if (elseBlock && elseBlock->statements.empty()) branch->elseBlock.reset();
+    } else if (auto loop = as<LoopNode>(slot)) {
+      scopes.enter();
+      fold(loop->init);
+      ++loopDepth;
+      const int outer = ++loopsFolded;
+      fold(loop->condition);
+      fold(loop->block);
+      fold(loop->after_loop);
+      --loopDepth;
+      loop->innermost = loopsFolded == outer;
+      loop->tripCount = tripCount(*loop);
+      loop->bodySize =
+          nodeCount(loop->block.get()) + nodeCount(loop->after_loop.get());
+      scopes.exit();
+      if (auto decl = as<VarDeclNode>(loop->init)) {
+        if (unused(decl)) loop->init.reset();
+      }
+    }
+  }
+
+  // Pass 3: strength reduction. Every instruction costs the same here, so a
+  // `mul` turned into an `add` next to the counter only pays off when the
+  // product is used more than once per iteration, or when the counter goes
+  // away entirely and the loop test moves to the derived variable.
+  void reduceInductions(Slot &slot) {
+    if (!slot) return;
+
+    if (auto block = as<BlockNode>(slot)) {
+      scopes.enter();
+      for (auto &stmt : block->statements) reduceInductions(stmt);
+      scopes.exit();
+    } else if (auto decl = as<VarDeclNode>(slot)) {
+      declare(decl, declaredInt(decl));
+    } else if (auto branch = as<IfNode>(slot)) {
+      reduceInductions(branch->thenBlock);
+      reduceInductions(branch->elseBlock);
+    } else if (auto loop = as<LoopNode>(slot)) {
+      scopes.enter();
+      reduceInductions(loop->init);
+      reduceInductions(loop->block);
+      Induction induction;
+      const bool reduced = findInduction(*loop, induction) &&
+                           reduceLoop(*loop, induction);
+      scopes.exit();
+      if (!reduced) return;
+
+      auto wrapper = std::make_unique<BlockNode>();
+      for (auto &[factor, name] : induction.derived) {
+        wrapper->statements.push_back(std::make_unique<VarDeclNode>(
+            name, Type::UNKNOWN, start(induction, factor).release()));
+      }
+      wrapper->statements.push_back(std::move(slot));
+      slot = std::move(wrapper);
+    }
+  }
+
+  // Pass 4: multiplications by a power of two become shifts
+  void lowerShifts(Slot &slot) {
+    if (!slot) return;
+
+    if (auto block = as<BlockNode>(slot)) {
+      scopes.enter();
+      for (auto &stmt : block->statements) lowerShifts(stmt);
+      scopes.exit();
+    } else if (auto decl = as<VarDeclNode>(slot)) {
+      lowerShifts(decl->expression);
+      declare(decl, declaredInt(decl));
+    } else if (auto assign = as<AssignNode>(slot)) {
+      lowerShifts(assign->expression);
+    } else if (auto unary = as<UnaryNode>(slot)) {
+      lowerShifts(unary->right);
+    } else if (auto macro = as<MacroNode>(slot)) {
+      lowerShifts(macro->arg);
+    } else if (auto branch = as<IfNode>(slot)) {
+      lowerShifts(branch->condition);
+      lowerShifts(branch->thenBlock);
+      lowerShifts(branch->elseBlock);
+    } else if (auto loop = as<LoopNode>(slot)) {
+      scopes.enter();
+      lowerShifts(loop->init);
+      lowerShifts(loop->condition);
+      lowerShifts(loop->block);
+      lowerShifts(loop->after_loop);
+      scopes.exit();
+    } else if (auto bin = as<BinaryNode>(slot)) {
+      lowerShifts(bin->left);
+      lowerShifts(bin->right);
+      if (bin->op != BinaryOp::MUL) return;
+      if (isNumber(bin->left)) std::swap(bin->left, bin->right);
+      if (isNumber(bin->right) && isPowerOfTwo(numberValue(bin->right)) &&
+          isInt(bin->left)) {
+        bin->op = BinaryOp::SHL;
+        bin->right = std::make_unique<NumberNode>(
+            std::countr_zero(static_cast<unsigned>(numberValue(bin->right))));
+      }
+    }
+  }
+
+  // Pass 5: loop-invariant code motion. Loops are visited outside in, an
+  // expression leaves every loop it doesn't depend on. Literals only leave
+  // the innermost one, they are cheap to reload and would hold a register
+  // for the whole outer loop.
+  void hoistInvariants(Slot &slot) {
+    if (!slot) return;
+
+    if (auto block = as<BlockNode>(slot)) {
+      for (auto &stmt : block->statements) hoistInvariants(stmt);
+    } else if (auto branch = as<IfNode>(slot)) {
+      hoistInvariants(branch->thenBlock);
+      hoistInvariants(branch->elseBlock);
+    } else if (auto loop = as<LoopNode>(slot)) {
+      Preheader preheader;
+      writtenNames(loop, preheader.variant);
+      hoistCondition(loop->condition, preheader, 0);
+      hoist(loop->block, preheader, 0);
+      hoist(loop->after_loop, preheader, 0);
+      hoistInvariants(loop->block);
+
+      if (preheader.decls.empty()) return;
+      auto wrapper = std::make_unique<BlockNode>();
+      for (auto &decl : preheader.decls) {
+        wrapper->statements.push_back(std::move(decl));
+      }
+      wrapper->statements.push_back(std::move(slot));
+      slot = std::move(wrapper);
+    }
+  }
+
+ private:
+  ScopedTable<Binding> scopes;
+  // the only macro without side effects
+  const Symbol len{"len!"};
+  int hoisted = 0;
+  int loopsFolded = 0;
+  std::unordered_set<const VarDeclNode *> mutated;
+  std::unordered_map<const VarDeclNode *, int> constants;
+  // references to constant bindings that are still in the tree
+  std::unordered_map<const VarDeclNode *, int> uses;
+  // redeclared in the same scope, codegen has to see them to report it
+  std::unordered_set<const VarDeclNode *> kept;
+  int loopDepth = 0;
+
+  // Iterations of `for let i = a; i < b; i += s` with a and b constant and i
+  // written nowhere else, -1 when unknown. Read by LoopNode::gen to unroll.
+  int64_t tripCount(const LoopNode &loop) const {
+    auto decl = as<VarDeclNode>(loop.init);
+    auto step = as<AssignNode>(loop.after_loop);
+    auto test = as<BinaryNode>(loop.condition);
+    if (!decl || !step || !test || step->name != decl->name ||
+        !isNumber(decl->expression)) {
+      return -1;
+    }
+    auto next = as<BinaryNode>(step->expression);
+    auto counter = next ? as<VariableNode>(next->left) : nullptr;
+    auto tested = as<VariableNode>(test->left);
+    int bound;
+    if (!counter || counter->name != decl->name || next->op != BinaryOp::ADD ||
+        !isNumber(next->right) || !tested || tested->name != decl->name ||
+        !constant(test->right, bound)) {
+      return -1;
+    }
+    std::unordered_set<Symbol> written;
+    writtenNames(loop.block.get(), written);
+    if (written.count(decl->name)) return -1;
+
+    const int64_t first = numberValue(decl->expression);
+    const int64_t s = numberValue(next->right);
+    // distance to cover and the last value the condition lets through
+    int64_t span;
+    if (test->op == BinaryOp::LT && s > 0) {
+      span = bound - first - 1;
+    } else if (test->op == BinaryOp::LE && s > 0) {
+      span = bound - first;
+    } else if (test->op == BinaryOp::GT && s < 0) {
+      span = first - bound - 1;
+    } else if (test->op == BinaryOp::GE && s < 0) {
+      span = first - bound;
+    } else {
+      return -1;
+    }
+    if (span < 0) return 0;
+    const int64_t count = span / std::abs(s) + 1;
+    // the counter must not wrap around on its way to the bound
+    const int64_t last = first + count * s;
+    if (last < INT32_MIN || last > INT32_MAX) return -1;
+    return count;
+  }
+
+  // `let i = a` in the init of a for loop whose step is `i += s`, with i
+  // written nowhere else in the loop
+  bool findInduction(const LoopNode &loop, Induction &induction) const {
+    auto decl = as<VarDeclNode>(loop.init);
+    auto step = as<AssignNode>(loop.after_loop);
+    if (!decl || !step || step->name != decl->name) return false;
+    auto next = as<BinaryNode>(step->expression);
+    auto counter = next ? as<VariableNode>(next->left) : nullptr;
+    if (!counter || counter->name != decl->name || next->op != BinaryOp::ADD ||
+        !isNumber(next->right)) {
+      return false;
+    }
+    if (!isNumber(decl->expression) && !as<VariableNode>(decl->expression)) {
+      return false;
+    }
+
+    std::unordered_set<Symbol> written;
+    writtenNames(loop.block.get(), written);
+    if (written.count(decl->name)) return false;
+    induction.name = decl->name;
+    induction.initial = decl->expression.get();
+    induction.step = numberValue(next->right);
+    return true;
+  }
+
+  bool reduceLoop(LoopNode &loop, Induction &induction) {
+    int bound = 0;
+    const bool replaceable = testedAgainst(loop, induction, bound);
+    if (!replaceable) countProducts(loop.condition, induction, false);
+    countProducts(loop.block, induction, false);
+    if (induction.products.empty()) return false;
+
+    // Instructions saved per iteration: each reduced product drops its `mul`
+    // where it feeds another operation (as a whole value it turns into a
+    // copy) and adds the step of its variable. Taking every product, the
+    // counter and its step may go too.
+    int all = 1;
+    int some = 0;
+    int best = 0;
+    for (const auto &[factor, product] : induction.products) {
+      all += product.operands - 1;
+      some += std::max(product.operands - 1, 0);
+      if (factor > 0 && !best && fitsTest(induction, factor, bound)) {
+        best = factor;
+      }
+    }
+    const bool dropCounter = replaceable && induction.otherUses == 0 && best &&
+                             all > std::max(some, 0);
+    if (!dropCounter && some <= 0) return false;
+
+    auto after = std::make_unique<BlockNode>();
+    if (!dropCounter) after->statements.push_back(std::move(loop.after_loop));
+    for (const auto &[factor, product] : induction.products) {
+      if (!dropCounter && product.operands < 2) continue;
+      const Symbol name("iv$" + std::to_string(++hoisted));
+      induction.derived[factor] = name;
+      after->statements.push_back(std::make_unique<AssignNode>(
+          name, increment(induction, factor, name).release()));
+    }
+    loop.after_loop = std::move(after);
+
+    if (dropCounter) {
+      auto test = as<BinaryNode>(loop.condition);
+      int limit;
+      evaluate(BinaryOp::MUL, bound, best, limit);
+      test->left = std::make_unique<VariableNode>(induction.derived.at(best));
+      test->right = std::make_unique<NumberNode>(limit);
+    } else {
+      reduce(loop.condition, induction);
+    }
+    reduce(loop.block, induction);
+    return true;
+  }
+
+  // Whether the loop runs while `i < bound` or similar, with the bound a
+  // constant and the counter moving towards it
+  bool testedAgainst(const LoopNode &loop, const Induction &induction,
+                     int &bound) const {
+    auto test = as<BinaryNode>(loop.condition);
+    if (!test || !isCounter(test->left, induction) ||
+        !constant(test->right, bound) ||
+        !dynamic_cast<const NumberNode *>(induction.initial)) {
+      return false;
+    }
+    const bool up = test->op == BinaryOp::LT || test->op == BinaryOp::LE;
+    const bool down = test->op == BinaryOp::GT || test->op == BinaryOp::GE;
+    return (up && induction.step > 0) || (down && induction.step < 0);
+  }
+
+  // i * factor compared against bound * factor can't overflow
+  static bool fitsTest(const Induction &induction, int factor, int bound) {
+    const int64_t first =
+        dynamic_cast<const NumberNode *>(induction.initial)->value;
+    const int64_t last = int64_t{bound} + induction.step;
+    const int64_t extreme = std::max(std::abs(first), std::abs(last)) * factor;
+    return extreme <= INT32_MAX;
+  }
+
+  // i * c with a literal c whose step s * c is an immediate, or the same
+  // literal the `mul` needed when s is 1
+  static bool reducible(const Slot &slot, const Induction &induction) {
+    auto bin = as<BinaryNode>(slot);
+    if (!bin || bin->op != BinaryOp::MUL || !isCounter(bin->left, induction) ||
+        !isNumber(bin->right)) {
+      return false;
+    }
+    int step;
+    evaluate(BinaryOp::MUL, induction.step, numberValue(bin->right), step);
+    return induction.step == 1 || (-2048 <= step && step < 2048);
+  }
+
+  void countProducts(const Slot &slot, Induction &induction, bool whole) {
+    if (!slot) return;
+
+    if (auto block = as<BlockNode>(slot)) {
+      for (auto &stmt : block->statements) countProducts(stmt, induction, false);
+    } else if (auto decl = as<VarDeclNode>(slot)) {
+      countProducts(decl->expression, induction, true);
+    } else if (auto assign = as<AssignNode>(slot)) {
+      countProducts(assign->expression, induction, true);
+    } else if (auto branch = as<IfNode>(slot)) {
+      countProducts(branch->condition, induction, false);
+      countProducts(branch->thenBlock, induction, false);
+      countProducts(branch->elseBlock, induction, false);
+    } else if (auto loop = as<LoopNode>(slot)) {
+      // code motion takes products out of inner loops, only count the reads
+      countProducts(loop->init, induction, false);
+      countReads(loop->condition.get(), induction);
+      countReads(loop->block.get(), induction);
+      countReads(loop->after_loop.get(), induction);
+    } else if (auto macro = as<MacroNode>(slot)) {
+      countProducts(macro->arg, induction, true);
+    } else if (auto unary = as<UnaryNode>(slot)) {
+      countProducts(unary->right, induction, false);
+    } else if (auto var = as<VariableNode>(slot)) {
+      if (var->name == induction.name) ++induction.otherUses;
+    } else if (auto bin = as<BinaryNode>(slot)) {
+      if (reducible(slot, induction)) {
+        auto &product = induction.products[numberValue(bin->right)];
+        ++(whole ? product.values : product.operands);
+        return;
+      }
+      countProducts(bin->left, induction, false);
+      countProducts(bin->right, induction, false);
+    }
+  }
+
+  void countReads(const Node *node, Induction &induction) {
+    if (!node) return;
+
+    if (auto var = dynamic_cast<const VariableNode *>(node)) {
+      if (var->name == induction.name) ++induction.otherUses;
+    } else if (auto block = dynamic_cast<const BlockNode *>(node)) {
+      for (const auto &stmt : block->statements) countReads(stmt.get(), induction);
+    } else if (auto decl = dynamic_cast<const VarDeclNode *>(node)) {
+      countReads(decl->expression.get(), induction);
+    } else if (auto assign = dynamic_cast<const AssignNode *>(node)) {
+      countReads(assign->expression.get(), induction);
+    } else if (auto bin = dynamic_cast<const BinaryNode *>(node)) {
+      countReads(bin->left.get(), induction);
+      countReads(bin->right.get(), induction);
+    } else if (auto unary = dynamic_cast<const UnaryNode *>(node)) {
+      countReads(unary->right.get(), induction);
+    } else if (auto macro = dynamic_cast<const MacroNode *>(node)) {
+      countReads(macro->arg.get(), induction);
+    } else if (auto branch = dynamic_cast<const IfNode *>(node)) {
+      countReads(branch->condition.get(), induction);
+      countReads(branch->thenBlock.get(), induction);
+      countReads(branch->elseBlock.get(), induction);
+    } else if (auto loop = dynamic_cast<const LoopNode *>(node)) {
+      countReads(loop->init.get(), induction);
+      countReads(loop->condition.get(), induction);
+      countReads(loop->block.get(), induction);
+      countReads(loop->after_loop.get(), induction);
+    }
+  }
+
+  // Replaces the chosen products with their derived variables
+  void reduce(Slot &slot, const Induction &induction) {
+    if (!slot) return;
+
+    if (auto block = as<BlockNode>(slot)) {
+      for (auto &stmt : block->statements) reduce(stmt, induction);
+    } else if (auto decl = as<VarDeclNode>(slot)) {
+      reduce(decl->expression, induction);
+    } else if (auto assign = as<AssignNode>(slot)) {
+      reduce(assign->expression, induction);
+    } else if (auto branch = as<IfNode>(slot)) {
+      reduce(branch->condition, induction);
+      reduce(branch->thenBlock, induction);
+      reduce(branch->elseBlock, induction);
+    } else if (auto loop = as<LoopNode>(slot)) {
+      reduce(loop->init, induction);
+    } else if (auto macro = as<MacroNode>(slot)) {
+      reduce(macro->arg, induction);
+    } else if (auto unary = as<UnaryNode>(slot)) {
+      reduce(unary->right, induction);
+    } else if (auto bin = as<BinaryNode>(slot)) {
+      if (reducible(slot, induction)) {
+        auto it = induction.derived.find(numberValue(bin->right));
+        if (it != induction.derived.end()) {
+          slot = std::make_unique<VariableNode>(it->second);
+          return;
+        }
+      }
+      reduce(bin->left, induction);
+      reduce(bin->right, induction);
+    }
+  }
+
+  static bool isCounter(const Slot &slot, const Induction &induction) {
+    auto var = as<VariableNode>(slot);
+    return var && var->name == induction.name;
+  }
+
+  // a * c
+  static Slot start(const Induction &induction, int factor) {
+    if (auto num = dynamic_cast<const NumberNode *>(induction.initial)) {
+      int res;
+      evaluate(BinaryOp::MUL, num->value, factor, res);
+      return std::make_unique<NumberNode>(res);
+    }
+    auto var = dynamic_cast<const VariableNode *>(induction.initial);
+    return std::make_unique<BinaryNode>(
+        BinaryOp::MUL, new VariableNode(var->name), new NumberNode(factor));
+  }
+
+  // name + s * c
+  static Slot increment(const Induction &induction, int factor, Symbol name) {
+    int step;
+    evaluate(BinaryOp::MUL, induction.step, factor, step);
+    return std::make_unique<BinaryNode>(BinaryOp::ADD, new VariableNode(name),
+                                        new NumberNode(step));
+  }
+
+  bool invariant(const Slot &slot, const Preheader &preheader) const {
+    if (isNumber(slot) || as<StringNode>(slot)) return true;
+    if (auto var = as<VariableNode>(slot)) {
+      return !preheader.variant.count(var->name);
+    }
+    if (auto bin = as<BinaryNode>(slot)) {
+      return invariant(bin->left, preheader) &&
+             invariant(bin->right, preheader);
+    }
+    if (auto unary = as<UnaryNode>(slot)) {
+      return invariant(unary->right, preheader);
+    }
+    // the other macros print
+    auto macro = as<MacroNode>(slot);
+    return macro && macro->name == len && invariant(macro->arg, preheader);
+  }
+
+  // Moves the value of `slot` in front of the loop, a variable takes its place
+  void moveOut(Slot &slot, Preheader &preheader) {
+    const Symbol name("inv$" + std::to_string(++hoisted));
+    preheader.decls.push_back(
+        std::make_unique<VarDeclNode>(name, Type::UNKNOWN, slot.release()));
+    slot = std::make_unique<VariableNode>(name);
+  }
+
+  void moveOutLiteral(Slot &slot, Preheader &preheader) {
+    const int value = numberValue(slot);
+    if (auto it = preheader.literals.find(value);
+        it != preheader.literals.end()) {
+      slot = std::make_unique<VariableNode>(it->second);
+      return;
+    }
+    moveOut(slot, preheader);
+    preheader.literals[value] = as<VariableNode>(slot)->name;
+  }
+
+  // `depth` counts the loops nested in the one being hoisted from
+  void hoist(Slot &slot, Preheader &preheader, int depth) {
+    if (!slot) return;
+
+    if (auto block = as<BlockNode>(slot)) {
+      for (auto &stmt : block->statements) hoist(stmt, preheader, depth);
+    } else if (auto decl = as<VarDeclNode>(slot)) {
+      hoist(decl->expression, preheader, depth);
+    } else if (auto assign = as<AssignNode>(slot)) {
+      hoist(assign->expression, preheader, depth);
+    } else if (auto branch = as<IfNode>(slot)) {
+      hoistCondition(branch->condition, preheader, depth);
+      hoist(branch->thenBlock, preheader, depth);
+      hoist(branch->elseBlock, preheader, depth);
+    } else if (auto loop = as<LoopNode>(slot)) {
+      hoist(loop->init, preheader, depth + 1);
+      hoistCondition(loop->condition, preheader, depth + 1);
+      hoist(loop->block, preheader, depth + 1);
+      hoist(loop->after_loop, preheader, depth + 1);
+    } else if (auto macro = as<MacroNode>(slot)) {
+      if (macro->name == len && invariant(slot, preheader)) {
+        moveOut(slot, preheader);
+      } else {
+        hoist(macro->arg, preheader, depth);
+      }
+    } else if (auto unary = as<UnaryNode>(slot)) {
+      if (invariant(slot, preheader)) {
+        moveOut(slot, preheader);
+      } else {
+        hoist(unary->right, preheader, depth);
+      }
+    } else if (auto bin = as<BinaryNode>(slot)) {
+      if (invariant(slot, preheader)) {
+        moveOut(slot, preheader);
+        return;
+      }
+      hoistOperand(bin->op, bin->left, false, preheader, depth);
+      hoistOperand(bin->op, bin->right, true, preheader, depth);
+    }
+  }
+
+  void hoistOperand(BinaryOp op, Slot &slot, bool right,
+                    Preheader &preheader, int depth) {
+    if (!isNumber(slot)) return hoist(slot, preheader, depth);
+    if (depth == 0 && needsRegister(op, numberValue(slot), right)) {
+      moveOutLiteral(slot, preheader);
+    }
+  }
+
+  // A comparison is a single branch wherever its operands come from, only
+  // they are worth moving out
+  void hoistCondition(Slot &slot, Preheader &preheader, int depth) {
+    if (auto bin = as<BinaryNode>(slot)) {
+      if (bin->op == BinaryOp::AND || bin->op == BinaryOp::OR) {
+        hoistCondition(bin->left, preheader, depth);
+        hoistCondition(bin->right, preheader, depth);
+        return;
+      }
+      if (isRelation(bin->op)) {
+        hoistOperand(bin->op, bin->left, false, preheader, depth);
+        hoistOperand(bin->op, bin->right, true, preheader, depth);
+        return;
+      }
+    }
+    if (auto unary = as<UnaryNode>(slot); unary && unary->op == UnaryOp::NOT) {
+      return hoistCondition(unary->right, preheader, depth);
+    }
+    hoist(slot, preheader, depth);
+  }
+
+  bool unused(const VarDeclNode *decl) const {
+    return constants.count(decl) && !uses.count(decl) && !kept.count(decl);
+  }
+
+  void declare(const VarDeclNode *decl, bool isInt) {
+    if (auto previous = scopes.findLocal(decl->name)) {
+      kept.insert(previous->decl);
+      kept.insert(decl);
+    }
+    scopes.bind(decl->name, Binding{decl, isInt, loopDepth});
+  }
+
+  const Binding *lookup(Symbol name) const { return scopes.find(name); }
+
+  bool declaredInt(const VarDeclNode *decl) const {
+    if (decl->declaredType != Type::UNKNOWN) {
+      return decl->declaredType == Type::I32 && isInt(decl->expression);
+    }
+    return isInt(decl->expression);
+  }
+
+  // Only integer operands may be dropped by an identity, folding `s + 0`
+  // would hide the type error of a string operand. An operator is only an
+  // integer when its operands type-check, the same rules as typeCheck().
+  bool isInt(const Slot &slot) const {
+    if (isNumber(slot)) return true;
+    if (auto unary = as<UnaryNode>(slot)) return isInt(unary->right);
+    if (auto bin = as<BinaryNode>(slot)) {
+      if (bin->op == BinaryOp::INDEX) {
+        return as<StringNode>(bin->left) && isInt(bin->right);
+      }
+      return isInt(bin->left) && isInt(bin->right);
+    }
+    if (auto macro = as<MacroNode>(slot)) {
+      return macro->name == len && as<StringNode>(macro->arg);
+    }
+    if (auto var = as<VariableNode>(slot)) {
+      auto binding = lookup(var->name);
+      return binding && binding->isInt;
+    }
+    return false;
+  }
+
+  // Literal or reference to a constant binding
+  bool constant(const Slot &slot, int &value) const {
+    if (isNumber(slot)) {
+      value = numberValue(slot);
+      return true;
+    }
+    auto var = as<VariableNode>(slot);
+    auto binding = var ? lookup(var->name) : nullptr;
+    if (!binding || !constants.count(binding->decl)) return false;
+    value = constants.at(binding->decl);
+    return true;
+  }
+
+  // Turn a constant operand into a literal, its parent is about to fold
+  int materialize(Slot &slot) {
+    int value = 0;  // callers checked constant() already
+    constant(slot, value);
+    if (auto var = as<VariableNode>(slot)) {
+      auto decl = lookup(var->name)->decl;
+      if (--uses[decl] == 0) uses.erase(decl);
+      slot = std::make_unique<NumberNode>(value);
+    }
+    return value;
+  }
+
+  void simplify(Slot &slot) {
+    auto bin = as<BinaryNode>(slot);
+    const auto &op = bin->op;
+    int l, r, res;
+
+    // a constant left operand decides && and || on its own
+    if ((op == BinaryOp::AND || op == BinaryOp::OR) && constant(bin->left, l) &&
+        (l != 0) == (op == BinaryOp::OR) && isInt(bin->right)) {
+      materialize(bin->left);
+      slot = std::make_unique<NumberNode>(l != 0);
+      return;
+    }
+
+    if (constant(bin->left, l) && constant(bin->right, r)) {
+      if (evaluate(op, l, r, res)) {
+        materialize(bin->left);
+        materialize(bin->right);
+        slot = std::make_unique<NumberNode>(res);
+      }
+      return;
+    }
+
+    // keep constants on the right of commutative operators
+    if ((op == BinaryOp::ADD || op == BinaryOp::MUL) &&
+        constant(bin->left, l)) {
+      std::swap(bin->left, bin->right);
+    }
+    if (!constant(bin->right, r) || !isInt(bin->left)) return;
+
+    // x - c -> x + (-c), so that it joins addition chains
+    if (op == BinaryOp::SUB && r != INT32_MIN) {
+      materialize(bin->right);
+      bin->op = BinaryOp::ADD;
+      bin->right = std::make_unique<NumberNode>(-r);
+      r = -r;
+    }
+
+    // (x op c1) op c2 -> x op (c1 op c2)
+    if (op == BinaryOp::ADD || op == BinaryOp::MUL) {
+      auto inner = as<BinaryNode>(bin->left);
+      if (inner && inner->op == op && constant(inner->right, l)) {
+        materialize(bin->right);
+        evaluate(op, materialize(inner->right), r, res);
+        inner->right = std::make_unique<NumberNode>(res);
+        slot = std::move(bin->left);
+        return simplify(slot);
+      }
+    }
+
+    const bool identity =
+        (op == BinaryOp::ADD && r == 0) ||
+        ((op == BinaryOp::MUL || op == BinaryOp::DIV) && r == 1);
+    if (identity) {
+      materialize(bin->right);
+      slot = std::move(bin->left);
+    } else if (op == BinaryOp::MUL && r == 0) {
+      materialize(bin->right);
+      slot = std::make_unique<NumberNode>(0);
+    }
+  }
+};
+
+}  // namespace
+
+void optimize(BlockNode *program) {
+  Optimizer optimizer;
+  optimizer.collect(program);
+
+  // the root block is owned by the parser, wrap it for the slot-based passes
+  Slot root(program);
+  optimizer.fold(root);
+  optimizer.reduceInductions(root);
+  optimizer.lowerShifts(root);
+  optimizer.hoistInvariants(root);
+  root.release();
+}
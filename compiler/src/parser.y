@@ -1,44 +1,47 @@
+%code requires {
+class Compilation;
+typedef void *yyscan_t;
+}
+
 %{
+#include <cstring>
 #include <iostream>
 #include <unordered_map>
 #include <vector>
 #include <string>
-#include <fstream>
-#include <sstream>
+#include "../src/compilation.hpp"
 #include "../src/compiler.hpp"
 #include "../src/error.hpp"
+%}
 
-void yyerror(const char* s) {
+%code {
+int yylex(YYSTYPE *lvalp, yyscan_t scanner);
+void restore_token_end(yyscan_t scanner);
+void yyerror(yyscan_t scanner, Compilation &, const char *s) {
+  restore_token_end(scanner);
   syntaxError(s);
 }
-int yylex();
-BlockNode* program = nullptr;
-extern char* yytext;
-extern int line_num;
-extern int column_num;
-extern std::string current_file;
-extern void set_current_file(const char* filename);
-
-// Buffer to accumulate source code for error reporting
-std::string source_buffer;
-std::string source_content;
-%}
+}
 
 %glr-parser
+%define api.pure
+%parse-param {yyscan_t scanner} {Compilation &unit}
+%lex-param {yyscan_t scanner}
 %expect 1
 %expect-rr 0
 
 %union {
   Node *node;
-  char* str;
+  Symbol sym;
   int num;
   Type type;
 }
 
 %token <num> NUMBER
-%token <str> IDENTIFIER STRING MACRO_IDENTIFIER
+%token <sym> IDENTIFIER STRING MACRO_IDENTIFIER
 %token PLUS MINUS STAR SLASH MODULO BREAK CONTINUE
-%token SEMICOLON COLON FOR LOOP
+%token SEMICOLON COLON LOOP
+%token <num> FOR
 %token ASSIGN PLUS_ASSIGN MINUS_ASSIGN STAR_ASSIGN SLASH_ASSIGN MODULO_ASSIGN
 %token EQ LT GT LEQ GEQ NEQ AND OR NOT
 %token IF ELSE WHILE LET
@@ -67,20 +70,20 @@ std::string source_content;
 
 program:
   items { 
-    $$ = program;
+    $$ = unit.program;
   }
   ;
 
 items:
   item { 
-    if (!program) {
-      program = new BlockNode();
+    if (!unit.program) {
+      unit.program = new BlockNode();
     }
     
-    program->addStatement($1);
+    unit.program->addStatement($1);
   }
   | items item {
-    program->addStatement($2);
+    unit.program->addStatement($2);
   }
   ;
 
@@ -141,19 +144,19 @@ assignment:
     $$ = new AssignNode($1, $3); 
   }
   | IDENTIFIER PLUS_ASSIGN expression { 
-    $$ = new AssignNode($1, new BinaryNode("+", new VariableNode($1), $3)); 
+    $$ = new AssignNode($1, new BinaryNode(BinaryOp::ADD, new VariableNode($1), $3)); 
   }
   | IDENTIFIER MINUS_ASSIGN expression { 
-    $$ = new AssignNode($1, new BinaryNode("-", new VariableNode($1), $3)); 
+    $$ = new AssignNode($1, new BinaryNode(BinaryOp::SUB, new VariableNode($1), $3)); 
   }
   | IDENTIFIER STAR_ASSIGN expression { 
-    $$ = new AssignNode($1, new BinaryNode("*", new VariableNode($1), $3)); 
+    $$ = new AssignNode($1, new BinaryNode(BinaryOp::MUL, new VariableNode($1), $3)); 
   }
   | IDENTIFIER SLASH_ASSIGN expression { 
-    $$ = new AssignNode($1, new BinaryNode("/", new VariableNode($1), $3)); 
+    $$ = new AssignNode($1, new BinaryNode(BinaryOp::DIV, new VariableNode($1), $3)); 
   }
   | IDENTIFIER MODULO_ASSIGN expression { 
-    $$ = new AssignNode($1, new BinaryNode("%", new VariableNode($1), $3)); 
+    $$ = new AssignNode($1, new BinaryNode(BinaryOp::REM, new VariableNode($1), $3)); 
   }
   ;
 
@@ -190,7 +193,9 @@ loop_statement:
 
 for_statement:
   FOR loop_expression SEMICOLON loop_expression SEMICOLON loop_expression block { 
-    $$ = new LoopNode($4, $7, $2, $6); 
+    auto loop = new LoopNode($4, $7, $2, $6);
+    loop->unroll = $1;
+    $$ = loop;
   }
   ;
 
@@ -215,50 +220,50 @@ precedence_max:
   ;
 
 precedence15:
-  precedence15 OR precedence14 { $$ = new BinaryNode("||", $1, $3); }
+  precedence15 OR precedence14 { $$ = new BinaryNode(BinaryOp::OR, $1, $3); }
   | precedence14 { $$ = $1; }
   ;
 
 precedence14:
-  precedence14 AND precedence10 { $$ = new BinaryNode("&&", $1, $3); }
+  precedence14 AND precedence10 { $$ = new BinaryNode(BinaryOp::AND, $1, $3); }
   | precedence10 { $$ = $1; }
   ;
 
 precedence10:
-  precedence10 EQ precedence9 { $$ = new BinaryNode("==", $1, $3); }
-  | precedence10 NEQ precedence9 { $$ = new BinaryNode("!=", $1, $3); }
+  precedence10 EQ precedence9 { $$ = new BinaryNode(BinaryOp::EQ, $1, $3); }
+  | precedence10 NEQ precedence9 { $$ = new BinaryNode(BinaryOp::NE, $1, $3); }
   | precedence9 { $$ = $1; }
   ;
 
 precedence9:
-  precedence9 LT precedence6 { $$ = new BinaryNode("<", $1, $3); }
-  | precedence9 GT precedence6 { $$ = new BinaryNode(">", $1, $3); }
-  | precedence9 GEQ precedence6 { $$ = new BinaryNode(">=",$1, $3); }
-  | precedence9 LEQ precedence6 { $$ = new BinaryNode("<=",$1, $3); }
+  precedence9 LT precedence6 { $$ = new BinaryNode(BinaryOp::LT, $1, $3); }
+  | precedence9 GT precedence6 { $$ = new BinaryNode(BinaryOp::GT, $1, $3); }
+  | precedence9 GEQ precedence6 { $$ = new BinaryNode(BinaryOp::GE, $1, $3); }
+  | precedence9 LEQ precedence6 { $$ = new BinaryNode(BinaryOp::LE, $1, $3); }
   | precedence6 { $$ = $1; }
   ;
 
 precedence6:
-  precedence6 PLUS precedence5 { $$ = new BinaryNode("+", $1, $3); }
-  | precedence6 MINUS precedence5 { $$ = new BinaryNode("-", $1, $3); }
+  precedence6 PLUS precedence5 { $$ = new BinaryNode(BinaryOp::ADD, $1, $3); }
+  | precedence6 MINUS precedence5 { $$ = new BinaryNode(BinaryOp::SUB, $1, $3); }
   | precedence5 { $$ = $1; }
   ;
 
 precedence5:
-  precedence5 STAR precedence3 { $$ = new BinaryNode("*", $1, $3); }
-  | precedence5 SLASH precedence3 { $$ = new BinaryNode("/", $1, $3); }
-  | precedence5 MODULO precedence3 { $$ = new BinaryNode("%", $1, $3); }
+  precedence5 STAR precedence3 { $$ = new BinaryNode(BinaryOp::MUL, $1, $3); }
+  | precedence5 SLASH precedence3 { $$ = new BinaryNode(BinaryOp::DIV, $1, $3); }
+  | precedence5 MODULO precedence3 { $$ = new BinaryNode(BinaryOp::REM, $1, $3); }
   | precedence3 { $$ = $1; }
   ;
 
 precedence3:
-  MINUS precedence3 %prec UMINUS { $$ = new UnaryNode("-", $2); }
-  | NOT precedence3 { $$ = new UnaryNode("!", $2); }
+  MINUS precedence3 %prec UMINUS { $$ = new UnaryNode(UnaryOp::NEG, $2); }
+  | NOT precedence3 { $$ = new UnaryNode(UnaryOp::NOT, $2); }
   | precedence2 { $$ = $1; }
   ;
 
 precedence2:
-  precedence2 OPEN_SUBSCRIPT precedence_max CLOSE_SUBSCRIPT { $$ = new BinaryNode("[]", $1, $3); }
+  precedence2 OPEN_SUBSCRIPT precedence_max CLOSE_SUBSCRIPT { $$ = new BinaryNode(BinaryOp::INDEX, $1, $3); }
   | precedence0 { $$ = $1; }
   ;
 
@@ -270,63 +275,3 @@ precedence0:
   ;
 
 %%
-
-extern FILE * yyin;
-
-#ifdef __EMSCRIPTEN__
-bool FORCE_STDIN = true;
-#else
-bool FORCE_STDIN = false;
-#endif
-
-int main(int argc, char **argv) {
-  program = nullptr;
-  yytext = nullptr;
-  line_num = 0;
-  column_num = 0;
-  current_file = "";
-
-  source_buffer = "";
-  source_content = "";
-
-  const auto f = FORCE_STDIN ? "/input.txt" : argv[1];
-
-  if (argc > 1 || FORCE_STDIN) {
-    set_current_file(f);
-    yyin = fopen(f, "r");
-    if (yyin == NULL) {
-        printf("syntax: %s filename\n", argv[0]);
-        return 1;
-    }
-    
-    load_source_file(f);
-  } else {
-    set_current_file("<stdin>");
-    
-    std::string line;
-    while (std::getline(std::cin, source_content)) {
-        source_buffer += source_content + "\n";
-    }
-    
-    std::istringstream input_stream(source_buffer);
-    yyin = tmpfile();
-    if (yyin == NULL) {
-        std::cerr << "Error: Could not create temporary file for input" << std::endl;
-        return 1;
-    }
-    
-    fputs(source_buffer.c_str(), yyin);
-    rewind(yyin);
-    
-    load_source_from_string(source_buffer);
-  }
-  
-  if (yyparse() == 0 && program) {
-    std::cerr << "\nParsing completed successfully. AST:" << std::endl;
-    program->print();
-    std::string asm_code = compile(program);
-    std::cout << asm_code << std::endl;;
-  }
-  
-  return 0;
-}
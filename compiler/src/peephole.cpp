@@ -0,0 +1,311 @@
+#include <algorithm>
+#include <vector>
+
+#include "ir.hpp"
+
+// Local clean-ups over the generated code, repeated until nothing changes:
+//  - store/load forwarding: a `lw` of a variable slot that was just stored or
+//    loaded becomes a register copy, and a store overwritten before anything
+//    could read it is dropped
+//  - copy folding: `op xT, ...; addi xV, xT, 0` writes xV directly when the
+//    temporary xT is dead afterwards
+//  - jump threading: jumps and branches to a `jal x0, L` go to L instead
+//  - jumps and branches to the next instruction are removed
+//  - branch inversion: `bCC L1; jal x0, L2; L1:` becomes `bNCC L2; L1:`
+//
+// It runs before branch relaxation, so every branch still has a label.
+
+namespace {
+
+constexpr int lastTempReg = 12;
+// registers a runtime routine may clobber, see Ctx
+constexpr int lastRoutineReg = 9;
+constexpr int returnReg = 31;
+
+bool isCall(const Instr &i) { return i.op == Op::JAL && i.rd == returnReg; }
+
+// Ends a basic block, or starts one in the case of a label
+bool isBoundary(const Instr &i) {
+  return i.op == Op::LABEL || isBranch(i.op) ||
+         (i.op == Op::JAL && !isCall(i)) || i.op == Op::JALR ||
+         i.op == Op::EBREAK;
+}
+
+bool reads(const Instr &i, int reg) {
+  if (reg == 0) return false;
+  switch (i.op) {
+    case Op::LUI:
+    case Op::LI:
+    case Op::EREAD:
+    case Op::EBREAK:
+    case Op::DATA:
+    case Op::LABEL:
+    case Op::COMMENT:
+      return false;
+    case Op::JAL:
+      // routines take their argument in x1
+      return isCall(i) && reg == 1;
+    case Op::ADDI:
+    case Op::XORI:
+    case Op::LW:
+    case Op::JALR:
+    case Op::EWRITE:
+      return i.rs1 == reg;
+    default:
+      return i.rs1 == reg || i.rs2 == reg;
+  }
+}
+
+bool writes(const Instr &i, int reg) {
+  if (reg == 0) return false;
+  if (isCall(i)) return reg <= lastRoutineReg || reg == returnReg;
+  switch (i.op) {
+    case Op::SW:
+    case Op::BEQ:
+    case Op::BNE:
+    case Op::BLT:
+    case Op::BGE:
+    case Op::EWRITE:
+    case Op::EBREAK:
+    case Op::DATA:
+    case Op::LABEL:
+    case Op::COMMENT:
+      return false;
+    default:
+      return i.rd == reg;
+  }
+}
+
+bool isCopy(const Instr &i) {
+  return i.op == Op::ADDI && i.imm == 0 && i.aux == NO_LABEL;
+}
+
+class Peephole {
+ public:
+  Peephole(std::vector<Instr> &code, size_t labelCount)
+      : code(code), labelCount(labelCount) {}
+
+  void run() {
+    for (bool changed = true; changed;) {
+      changed = forwardMemory();
+      changed |= foldCopies();
+      changed |= threadJumps();
+      changed |= removeJumpsToNext();
+      changed |= invertBranches();
+      compact();
+    }
+  }
+
+ private:
+  std::vector<Instr> &code;
+  size_t labelCount;
+  std::vector<bool> removed;
+
+  void remove(size_t i) { removed[i] = true; }
+
+  void compact() {
+    std::vector<Instr> result;
+    result.reserve(code.size());
+    for (size_t i = 0; i < code.size(); ++i) {
+      if (!removed[i]) result.push_back(code[i]);
+    }
+    code = std::move(result);
+    removed.assign(code.size(), false);
+  }
+
+  size_t next(size_t i) const {
+    ++i;
+    while (i < code.size() && removed[i]) ++i;
+    return i;
+  }
+
+  // Whether `reg` is overwritten before being read when execution continues
+  // after instruction `i`. Unknown at the end of a basic block.
+  bool deadAfter(size_t i, int reg) const {
+    for (size_t j = next(i); j < code.size(); j = next(j)) {
+      const auto &ins = code[j];
+      if (reads(ins, reg)) return false;
+      if (writes(ins, reg)) return true;
+      if (ins.op == Op::EBREAK) return true;
+      if (isBoundary(ins)) return false;
+    }
+    return true;
+  }
+
+  // Within a basic block, remembers which register holds each variable slot
+  // and which store to it nothing has read yet
+  bool forwardMemory() {
+    removed.assign(code.size(), false);
+    bool changed = false;
+    struct Slot {
+      int offset;
+      int reg;
+      size_t store;  // index of the unread store, SIZE_MAX if read
+    };
+    std::vector<Slot> slots;
+    auto find = [&](int offset) {
+      return std::find_if(slots.begin(), slots.end(),
+                          [&](const Slot &s) { return s.offset == offset; });
+    };
+
+    for (size_t i = 0; i < code.size(); ++i) {
+      auto &ins = code[i];
+      if (isBoundary(ins)) {
+        slots.clear();
+        continue;
+      }
+
+      if (ins.op == Op::SW && ins.rs1 == 0) {
+        auto slot = find(ins.imm);
+        if (slot != slots.end()) {
+          if (slot->store != SIZE_MAX) {
+            remove(slot->store);
+            changed = true;
+          }
+          slots.erase(slot);
+        }
+        slots.push_back({ins.imm, ins.rs2, i});
+        continue;
+      }
+
+      if (ins.op == Op::LW && ins.rs1 == 0) {
+        if (auto slot = find(ins.imm); slot != slots.end()) {
+          slot->store = SIZE_MAX;
+          if (ins.rd == slot->reg) {
+            remove(i);
+          } else {
+            ins = {Op::ADDI, ins.rd, static_cast<uint8_t>(slot->reg), 0, 0,
+                   NO_LABEL};
+          }
+          changed = true;
+        }
+      } else if (ins.op == Op::LW) {
+        // addressed through a register, may read any slot
+        for (auto &slot : slots) slot.store = SIZE_MAX;
+      } else if (ins.op == Op::SW || isCall(ins)) {
+        // may write any slot, routines also use memory
+        slots.clear();
+      }
+
+      std::erase_if(slots, [&](const Slot &s) { return writes(ins, s.reg); });
+      if (ins.op == Op::LW && ins.rs1 == 0 && ins.rd != 0) {
+        slots.push_back({ins.imm, ins.rd, SIZE_MAX});
+      }
+    }
+    return changed;
+  }
+
+  bool foldCopies() {
+    bool changed = false;
+    for (size_t i = 0; i < code.size(); i = next(i)) {
+      auto &ins = code[i];
+      if (isCopy(ins) && ins.rd == ins.rs1) {
+        remove(i);
+        changed = true;
+        continue;
+      }
+      const size_t j = next(i);
+      if (j >= code.size() || !isCopy(code[j])) continue;
+      const int temp = code[j].rs1;
+      if (temp == 0 || temp > lastTempReg || temp == code[j].rd) continue;
+      if (isBoundary(ins) || isCall(ins) || !writes(ins, temp)) continue;
+      if (!deadAfter(j, temp)) continue;
+      ins.rd = code[j].rd;
+      remove(j);
+      changed = true;
+    }
+    return changed;
+  }
+
+  // Label -> first instruction after it that is not a label
+  std::vector<size_t> labelTargets() const {
+    std::vector<size_t> targets(labelCount, SIZE_MAX);
+    for (size_t i = 0; i < code.size(); ++i) {
+      if (code[i].op != Op::LABEL || removed[i]) continue;
+      size_t j = next(i);
+      while (j < code.size() && code[j].op == Op::LABEL) j = next(j);
+      targets[code[i].aux] = j;
+    }
+    return targets;
+  }
+
+  bool threadJumps() {
+    const auto targets = labelTargets();
+    // final destination of a chain of jumps, cycles are left alone
+    auto resolve = [&](Label label) {
+      for (size_t hops = 0; hops < 16; ++hops) {
+        const size_t t = targets[label];
+        if (t >= code.size() || code[t].op != Op::JAL || isCall(code[t]) ||
+            code[t].aux == NO_LABEL || code[t].aux == label) {
+          break;
+        }
+        label = code[t].aux;
+      }
+      return label;
+    };
+
+    bool changed = false;
+    for (size_t i = 0; i < code.size(); i = next(i)) {
+      auto &ins = code[i];
+      if (ins.aux == NO_LABEL || !(isBranch(ins.op) || ins.op == Op::JAL) ||
+          isCall(ins)) {
+        continue;
+      }
+      const Label label = resolve(ins.aux);
+      if (label != ins.aux) {
+        ins.aux = label;
+        changed = true;
+      }
+    }
+    return changed;
+  }
+
+  // Whether `label` is defined among the labels that directly follow `i`
+  bool labelFollows(size_t i, Label label) const {
+    for (size_t j = next(i); j < code.size() && code[j].op == Op::LABEL;
+         j = next(j)) {
+      if (code[j].aux == label) return true;
+    }
+    return false;
+  }
+
+  bool removeJumpsToNext() {
+    bool changed = false;
+    for (size_t i = 0; i < code.size(); i = next(i)) {
+      const auto &ins = code[i];
+      if ((isBranch(ins.op) || (ins.op == Op::JAL && ins.rd == 0)) &&
+          ins.aux != NO_LABEL && labelFollows(i, ins.aux)) {
+        remove(i);
+        changed = true;
+      }
+    }
+    return changed;
+  }
+
+  bool invertBranches() {
+    bool changed = false;
+    for (size_t i = 0; i < code.size(); i = next(i)) {
+      auto &ins = code[i];
+      const size_t j = next(i);
+      if (!isBranch(ins.op) || ins.aux == NO_LABEL || j >= code.size()) {
+        continue;
+      }
+      const auto &jump = code[j];
+      if (jump.op != Op::JAL || jump.rd != 0 || jump.aux == NO_LABEL ||
+          !labelFollows(j, ins.aux)) {
+        continue;
+      }
+      ins.op = invertBranch(ins.op);
+      ins.aux = jump.aux;
+      remove(j);
+      changed = true;
+    }
+    return changed;
+  }
+};
+
+}  // namespace
+
+void peephole(std::vector<Instr> &code, size_t labelCount) {
+  Peephole(code, labelCount).run();
+}
@@ -0,0 +1,157 @@
+#include <algorithm>
+#include <memory>
+#include <ranges>
+#include <vector>
+
+#include "compiler.hpp"
+
+// Linear scan allocation of local variables to x13 .. x29.
+//
+// Every node gets a position in codegen order. A variable lives from its
+// declaration to its last use; a use inside a loop that started after the
+// declaration keeps the variable alive until the end of that loop, since the
+// next iteration reads it again. When the registers run out, the interval
+// with the smallest weight (uses scaled by loop depth) goes to memory.
+
+namespace {
+
+struct Interval {
+  const VarDeclNode *decl;
+  int start;
+  int end;
+  long weight = 0;
+};
+
+struct LoopFrame {
+  int start;
+  std::vector<Interval *> used;
+};
+
+class LivenessBuilder {
+ public:
+  std::vector<std::unique_ptr<Interval>> intervals;
+
+  void visit(const Node *node) {
+    if (!node) return;
+
+    if (auto block = dynamic_cast<const BlockNode *>(node)) {
+      scopes.enter();
+      for (const auto &stmt : block->statements) visit(stmt.get());
+      scopes.exit();
+    } else if (auto decl = dynamic_cast<const VarDeclNode *>(node)) {
+      visit(decl->expression.get());
+      intervals.push_back(std::make_unique<Interval>(
+          Interval{decl, ++position, position}));
+      scopes.bind(decl->name, intervals.back().get());
+      use(intervals.back().get());
+    } else if (auto assign = dynamic_cast<const AssignNode *>(node)) {
+      visit(assign->expression.get());
+      ++position;
+      use(assign->name);
+    } else if (auto var = dynamic_cast<const VariableNode *>(node)) {
+      ++position;
+      use(var->name);
+    } else if (auto bin = dynamic_cast<const BinaryNode *>(node)) {
+      visit(bin->left.get());
+      visit(bin->right.get());
+    } else if (auto unary = dynamic_cast<const UnaryNode *>(node)) {
+      visit(unary->right.get());
+    } else if (auto macro = dynamic_cast<const MacroNode *>(node)) {
+      visit(macro->arg.get());
+    } else if (auto branch = dynamic_cast<const IfNode *>(node)) {
+      visit(branch->condition.get());
+      visit(branch->thenBlock.get());
+      visit(branch->elseBlock.get());
+    } else if (auto loop = dynamic_cast<const LoopNode *>(node)) {
+      scopes.enter();
+      visit(loop->init.get());
+      loops.push_back({++position, {}});
+      visit(loop->condition.get());
+      visit(loop->block.get());
+      visit(loop->after_loop.get());
+      exitLoop(++position);
+      scopes.exit();
+    }
+  }
+
+ private:
+  ScopedTable<Interval *> scopes;
+  std::vector<LoopFrame> loops;
+  int position = 0;
+
+  void use(Symbol name) {
+    if (auto interval = scopes.find(name)) use(*interval);
+  }
+
+  void use(Interval *interval) {
+    interval->end = std::max(interval->end, position);
+    interval->weight += 1L << (3 * std::min<size_t>(loops.size(), 8));
+    if (!loops.empty()) loops.back().used.push_back(interval);
+  }
+
+  void exitLoop(int end) {
+    auto frame = std::move(loops.back());
+    loops.pop_back();
+    for (auto interval : frame.used) {
+      if (interval->start < frame.start) {
+        interval->end = std::max(interval->end, end);
+        if (!loops.empty()) loops.back().used.push_back(interval);
+      }
+    }
+  }
+};
+
+}  // namespace
+
+void allocateRegisters(BlockNode *block) {
+  LivenessBuilder liveness;
+  liveness.visit(block);
+
+  std::vector<Interval *> order;
+  for (auto &interval : liveness.intervals) order.push_back(interval.get());
+  std::ranges::sort(order, {}, &Interval::start);
+
+  std::vector<int> free;
+  for (int reg = Ctx::lastVarReg; reg >= Ctx::firstVarReg; --reg) {
+    free.push_back(reg);
+  }
+  std::vector<Interval *> active;
+
+  for (auto current : order) {
+    std::erase_if(active, [&](Interval *interval) {
+      if (interval->end >= current->start) return false;
+      free.push_back(interval->decl->reg);
+      return true;
+    });
+
+    if (!free.empty()) {
+      current->decl->reg = free.back();
+      free.pop_back();
+      active.push_back(current);
+      continue;
+    }
+
+    auto victim = *std::ranges::min_element(active, {}, &Interval::weight);
+    if (victim->weight < current->weight) {
+      current->decl->reg = victim->decl->reg;
+      victim->decl->reg = 0;
+      std::erase(active, victim);
+      active.push_back(current);
+    } else {
+      current->decl->reg = 0;
+    }
+  }
+
+  if (tracing(Trace::GEN)) {
+    for (auto interval : order) {
+      trace() << "gen: " << interval->decl->name.str() << " ["
+              << interval->start << ", " << interval->end << "] weight "
+              << interval->weight << " -> ";
+      if (interval->decl->reg) {
+        trace() << "x" << interval->decl->reg << '\n';
+      } else {
+        trace() << "memory\n";
+      }
+    }
+  }
+}
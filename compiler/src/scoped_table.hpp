@@ -0,0 +1,73 @@
+#ifndef SCOPED_TABLE_HPP
+#define SCOPED_TABLE_HPP
+
+#include <cstdint>
+#include <vector>
+
+#include "symbol.hpp"
+
+// Bindings of names to values across nested scopes, in one table for all of
+// them. Symbol ids are dense, so `heads` is indexed by the id directly and
+// finds the innermost binding with a single load however deep the nesting.
+// Bindings sit on a stack in declaration order, each one remembering the
+// binding it shadows; leaving a scope pops its bindings and puts the
+// shadowed ones back.
+template <typename T>
+class ScopedTable {
+ public:
+  void enter() { marks.push_back(bindings.size()); }
+
+  void exit() {
+    const size_t mark = marks.back();
+    marks.pop_back();
+    while (bindings.size() > mark) {
+      const auto &binding = bindings.back();
+      heads[binding.name.id] = binding.shadowed;
+      bindings.pop_back();
+    }
+  }
+
+  // scopes entered and not exited yet
+  size_t depth() const { return marks.size(); }
+
+  // Binds `name` in the innermost scope. A binding of the same name in that
+  // scope is hidden like an outer one would be.
+  T &bind(Symbol name, const T &value) {
+    if (name.id >= heads.size()) heads.resize(name.id + 1, none);
+    bindings.push_back({value, name, heads[name.id]});
+    heads[name.id] = static_cast<int32_t>(bindings.size() - 1);
+    return bindings.back().value;
+  }
+
+  // innermost binding of `name`, nullptr if there is none
+  T *find(Symbol name) {
+    const int32_t head = name.id < heads.size() ? heads[name.id] : none;
+    return head == none ? nullptr : &bindings[head].value;
+  }
+  const T *find(Symbol name) const {
+    return const_cast<ScopedTable *>(this)->find(name);
+  }
+
+  // binding of `name` made since the innermost scope was entered
+  T *findLocal(Symbol name) {
+    const int32_t head = name.id < heads.size() ? heads[name.id] : none;
+    const size_t mark = marks.empty() ? 0 : marks.back();
+    return head == none || static_cast<size_t>(head) < mark
+               ? nullptr
+               : &bindings[head].value;
+  }
+
+ private:
+  static constexpr int32_t none = -1;
+
+  struct Binding {
+    T value;
+    Symbol name;
+    int32_t shadowed;
+  };
+  std::vector<int32_t> heads;
+  std::vector<Binding> bindings;
+  std::vector<size_t> marks;
+};
+
+#endif  // SCOPED_TABLE_HPP
@@ -0,0 +1,112 @@
+#include "source.hpp"
+
+#include <algorithm>
+
+#if defined(__unix__) && !defined(__EMSCRIPTEN__)
+#define SUS_MMAP 1
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+bool Source::open(const char *path) {
+  close();
+#ifdef SUS_MMAP
+  const int fd = ::open(path, O_RDONLY);
+  if (fd < 0) return false;
+  struct stat info;
+  if (fstat(fd, &info) == 0 && S_ISREG(info.st_mode)) {
+    // the bytes between the end of the file and the end of its last page
+    // read as zero, they serve as the NULs flex needs when there are two
+    const size_t length = info.st_size;
+    const size_t page = sysconf(_SC_PAGESIZE);
+    const size_t tail = length % page;
+    if (tail != 0 && page - tail >= 2) {
+      // private and writable: the pages flex writes to are copied, the
+      // file stays untouched
+      void *map = mmap(nullptr, length + 2, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE, fd, 0);
+      if (map != MAP_FAILED) {
+        ::close(fd);
+        data = static_cast<char *>(map);
+        size = length;
+        mapped = length + 2;
+        return true;
+      }
+    }
+  }
+  FILE *file = fdopen(fd, "rb");
+  if (!file) {
+    ::close(fd);
+    return false;
+  }
+#else
+  FILE *file = std::fopen(path, "rb");
+  if (!file) return false;
+#endif
+  const bool ok = read(file);
+  std::fclose(file);
+  return ok;
+}
+
+bool Source::read(FILE *stream) {
+  close();
+  size_t length = 0;
+  owned.resize(64 * 1024);
+  while (const size_t n = std::fread(owned.data() + length, 1,
+                                     owned.size() - length, stream)) {
+    length += n;
+    if (length == owned.size()) owned.resize(2 * length);
+  }
+  owned.resize(length);
+  own();
+  return !std::ferror(stream);
+}
+
+void Source::assign(std::string_view text) {
+  close();
+  owned.assign(text.begin(), text.end());
+  own();
+}
+
+void Source::own() {
+  size = owned.size();
+  owned.push_back('\0');
+  owned.push_back('\0');
+  data = owned.data();
+}
+
+void Source::close() {
+#ifdef SUS_MMAP
+  if (mapped) munmap(data, mapped);
+#endif
+  data = nullptr;
+  size = 0;
+  mapped = 0;
+  owned.clear();
+  lineStarts.clear();
+}
+
+void Source::indexLines() const {
+  if (!lineStarts.empty() || size == 0) return;
+  lineStarts.push_back(0);
+  for (size_t i = 0; i + 1 < size; ++i) {
+    if (data[i] == '\n') lineStarts.push_back(i + 1);
+  }
+}
+
+int Source::lineCount() const {
+  indexLines();
+  return static_cast<int>(lineStarts.size());
+}
+
+std::string_view Source::line(int number) const {
+  indexLines();
+  if (number < 1 || number > static_cast<int>(lineStarts.size())) return {};
+  const size_t start = lineStarts[number - 1];
+  const size_t end = number < static_cast<int>(lineStarts.size())
+                         ? lineStarts[number] - 1
+                         : size - (data[size - 1] == '\n');
+  return {data + start, end - start};
+}
@@ -0,0 +1,50 @@
+#ifndef SOURCE_HPP
+#define SOURCE_HPP
+
+#include <cstddef>
+#include <cstdio>
+#include <string_view>
+#include <vector>
+
+// Text of the program being compiled, read exactly once. Files are mapped
+// into memory where the platform allows it. The scanner works on the buffer
+// in place through yy_scan_buffer(), and error reporting quotes lines out of
+// the same bytes.
+class Source {
+ public:
+  Source() = default;
+  Source(const Source &) = delete;
+  Source &operator=(const Source &) = delete;
+  ~Source() { close(); }
+
+  // false when the file can't be read
+  bool open(const char *path);
+  // everything up to the end of `stream`, for stdin
+  bool read(FILE *stream);
+  void assign(std::string_view text);
+  void close();
+
+  std::string_view text() const { return {data, size}; }
+
+  // For yy_scan_buffer(): the text followed by the two NUL bytes flex wants
+  // at the end. Flex writes into it while scanning.
+  char *scanBuffer() { return data; }
+  size_t scanSize() const { return size + 2; }
+
+  // Line `number`, counted from 1, without its line break. Line offsets are
+  // only computed when the first line is asked for, which is on an error.
+  std::string_view line(int number) const;
+  int lineCount() const;
+
+ private:
+  char *data = nullptr;
+  size_t size = 0;
+  size_t mapped = 0;        // length of the mapping, 0 if `data` is `owned`
+  std::vector<char> owned;  // text read by read() or copied by assign()
+  mutable std::vector<size_t> lineStarts;
+
+  void own();
+  void indexLines() const;
+};
+
+#endif  // SOURCE_HPP
@@ -0,0 +1,40 @@
+#ifndef SUS_HPP
+#define SUS_HPP
+
+#include <string>
+#include <string_view>
+
+// Interface of libsus.a, the compiler as a library. Every call compiles on
+// state of its own, so one process can compile any number of programs back
+// to back, a failing one included, and separate threads can do so at the
+// same time. Tracing (--trace) goes to one shared stream and is meant for
+// single compilations.
+
+struct Options {
+  // 0 - code as generated, 1 - peephole pass over the result
+  int optLevel = 1;
+  // unroll factor for innermost for loops with a known iteration count,
+  // 1 leaves them rolled. `// #pragma unroll N` overrides it per loop.
+  // Factors above maxUnroll count as maxUnroll, and loops with a large body
+  // get fewer copies.
+  int unroll = 1;
+  static constexpr int maxUnroll = 16;
+};
+
+struct Result {
+  bool ok = false;
+  // program for the vm, empty on failure
+  std::string assembly;
+  // The first error, formatted the way the command line tool prints it,
+  // with the lines around it. Line and column count from 1, 0 when the
+  // error has no place in the program.
+  std::string error;
+  int line = 0;
+  int column = 0;
+};
+
+// `filename` only appears in the error message
+Result compile(std::string_view program, const Options &options = {},
+               std::string_view filename = "<input>");
+
+#endif  // SUS_HPP
@@ -0,0 +1,13 @@
+#include "symbol.hpp"
+
+uint32_t SymbolTable::intern(std::string_view name) {
+  if (auto it = ids.find(name); it != ids.end()) return it->second;
+  const auto id = static_cast<uint32_t>(names.size());
+  names.push_back(storage.copy(name));
+  ids.emplace(names.back(), id);
+  return id;
+}
+
+Symbol::Symbol(std::string_view name) : id(symbols().intern(name)) {}
+
+std::string_view Symbol::str() const { return symbols().name(id); }
@@ -0,0 +1,48 @@
+#ifndef SYMBOL_HPP
+#define SYMBOL_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "arena.hpp"
+
+// Interned name. Every spelling is stored once and equal names share an id,
+// so comparing and hashing a Symbol is a single integer operation. Ids are
+// only meaningful within the compilation that made them.
+struct Symbol {
+  // no initializer, the parser keeps Symbols in its value union
+  uint32_t id;
+
+  Symbol() = default;
+  explicit Symbol(std::string_view name);
+
+  std::string_view str() const;
+
+  friend bool operator==(Symbol a, Symbol b) { return a.id == b.id; }
+};
+
+template <>
+struct std::hash<Symbol> {
+  size_t operator()(Symbol symbol) const noexcept { return symbol.id; }
+};
+
+// Spellings of the identifiers and string literals of one compilation
+class SymbolTable {
+ public:
+  uint32_t intern(std::string_view name);
+  std::string_view name(uint32_t id) const { return names[id]; }
+
+ private:
+  std::unordered_map<std::string_view, uint32_t> ids;
+  std::vector<std::string_view> names;
+  Arena storage;
+};
+
+// names of the current Compilation
+SymbolTable &symbols();
+
+#endif  // SYMBOL_HPP
@@ -0,0 +1,75 @@
+#include "trace.hpp"
+
+#include <cstdio>
+#include <streambuf>
+
+namespace {
+
+class TraceBuffer : public std::streambuf {
+ public:
+  TraceBuffer() { setp(data, data + sizeof data); }
+  ~TraceBuffer() override { sync(); }
+
+ protected:
+  int overflow(int c) override {
+    sync();
+    if (c != traits_type::eof()) {
+      *pptr() = static_cast<char>(c);
+      pbump(1);
+    }
+    return traits_type::not_eof(c);
+  }
+
+  int sync() override {
+    std::fwrite(pbase(), 1, pptr() - pbase(), stderr);
+    std::fflush(stderr);
+    setp(data, data + sizeof data);
+    return 0;
+  }
+
+ private:
+  char data[64 * 1024];
+};
+
+}  // namespace
+
+#if SUS_TRACE
+unsigned traceMask = 0;
+#endif
+
+bool enableTrace(std::string_view channels) {
+#if SUS_TRACE
+  while (!channels.empty()) {
+    const auto comma = channels.find(',');
+    const auto name = channels.substr(0, comma);
+    if (name == "lex") {
+      traceMask |= static_cast<unsigned>(Trace::LEX);
+    } else if (name == "ast") {
+      traceMask |= static_cast<unsigned>(Trace::AST);
+    } else if (name == "gen") {
+      traceMask |= static_cast<unsigned>(Trace::GEN);
+    } else {
+      return false;
+    }
+    channels.remove_prefix(comma == channels.npos ? channels.size()
+                                                  : comma + 1);
+  }
+#else
+  std::fputs("warning: built without tracing, --trace is ignored\n", stderr);
+#endif
+  return true;
+}
+
+std::ostream &trace() {
+  static TraceBuffer buffer;
+  static std::ostream stream(&buffer);
+  return stream;
+}
+
+void flushTrace() {
+#if SUS_TRACE
+  // compilations on other threads may be running, the stream is only
+  // touched when there is a trace to write
+  if (traceMask) trace().flush();
+#endif
+}
@@ -0,0 +1,41 @@
+#ifndef TRACE_HPP
+#define TRACE_HPP
+
+#include <ostream>
+#include <string_view>
+
+// Diagnostic output of the compiler's phases, off unless asked for with
+// `--trace=lex,ast,gen`. Release builds (NDEBUG) compile every trace point
+// out: tracing() is a constant false there and the code behind it goes away.
+#ifndef SUS_TRACE
+#ifdef NDEBUG
+#define SUS_TRACE 0
+#else
+#define SUS_TRACE 1
+#endif
+#endif
+
+enum class Trace : unsigned {
+  LEX = 1 << 0,  // every token the scanner returns
+  AST = 1 << 1,  // the tree as parsed and after optimize()
+  GEN = 1 << 2,  // register assignment and the size of the code per pass
+};
+
+#if SUS_TRACE
+extern unsigned traceMask;
+inline bool tracing(Trace channel) {
+  return traceMask & static_cast<unsigned>(channel);
+}
+#else
+constexpr bool tracing(Trace) { return false; }
+#endif
+
+// Turns on the comma separated channels, false if one of them is unknown
+bool enableTrace(std::string_view channels);
+
+// Stream the trace goes to. It is buffered, output reaches stderr in large
+// writes, at flushTrace() and at exit.
+std::ostream &trace();
+void flushTrace();
+
+#endif  // TRACE_HPP
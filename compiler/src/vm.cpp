@@ -0,0 +1,698 @@
+// Native emulator for the course RISC machine (see README.md).
+//
+// Assembles the text produced by compile() into the 65536 x 32-bit memory
+// image using the same encodings as main.js, then runs it with a pre-decoded
+// dispatch loop. Every memory cell has a decoded twin; `sw` re-decodes the
+// cell it writes, so self-modifying programs behave like in the browser.
+
+#include <cctype>
+#include <charconv>
+#include <climits>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace {
+
+constexpr uint32_t MEMORY_SIZE = 1 << 16;
+// writes to x0 are redirected here so handlers never test rd == 0
+constexpr uint8_t ZERO_SINK = 32;
+
+enum Op : uint8_t {
+  HALT,  // undecodable cell, stops the machine like a null command in main.js
+  LUI,
+  JAL,
+  JALR,
+  BEQ,
+  BNE,
+  BLT,
+  BGE,
+  LW,
+  SW,
+  ADDI,
+  XORI,
+  ADD,
+  SUB,
+  SLL,
+  SLT,
+  SEQ,
+  SNE,
+  SGE,
+  XOR,
+  SRL,
+  SRA,
+  OR,
+  AND,
+  MUL,
+  DIV,
+  REM,
+  EBREAK,
+  EREAD,
+  EWRITE,
+  OP_COUNT
+};
+
+struct Decoded {
+  Op op = HALT;
+  uint8_t rd = ZERO_SINK;
+  uint8_t rs1 = 0;
+  uint8_t rs2 = 0;
+  int32_t imm = 0;
+};
+
+struct Machine {
+  std::vector<int32_t> memory = std::vector<int32_t>(MEMORY_SIZE, 0);
+  // one extra HALT cell so falling off the end of memory stops the machine
+  std::vector<Decoded> code = std::vector<Decoded>(MEMORY_SIZE + 1);
+  int32_t regs[33] = {};
+  // dynamic event counts, reported next to the instruction count
+  uint64_t loads = 0;
+  uint64_t stores = 0;
+  uint64_t taken_branches = 0;
+  uint64_t jumps = 0;
+  // the program was stopped by --max-steps, not by itself
+  bool out_of_steps = false;
+};
+
+int32_t signExtend(uint32_t val, int bits) {
+  const uint32_t shift = 32 - bits;
+  return static_cast<int32_t>(val << shift) >> shift;
+}
+
+// Mirror of decodeCommand() in main.js
+Decoded decode(uint32_t code) {
+  Decoded d;
+  const uint32_t funct3 = (code >> 12) & 7;
+  const uint32_t funct7 = (code >> 25) & 127;
+  const uint32_t rd = (code >> 7) & 31;
+  d.rs1 = (code >> 15) & 31;
+  d.rs2 = (code >> 20) & 31;
+  d.rd = rd == 0 ? ZERO_SINK : rd;
+
+  switch (code & 0x7F) {
+    case 0b0110111:
+      d.op = LUI;
+      d.imm = static_cast<int32_t>(((code >> 12) & 0xFFFFF) << 12);
+      break;
+    case 0b1101111:
+      d.op = JAL;
+      d.imm = signExtend((code >> 12) & 0xFFFFF, 20);
+      break;
+    case 0b1100111:
+      if (funct3 != 0) break;
+      d.op = JALR;
+      d.imm = signExtend((code >> 20) & 0xFFF, 12);
+      break;
+    case 0b1100011: {
+      const uint32_t immb = (((code >> 7) & 1) << 10) | (((code >> 8) & 15) << 0) |
+                            (((code >> 25) & 63) << 4) | (((code >> 31) & 1) << 11);
+      d.imm = signExtend(immb, 12);
+      switch (funct3) {
+        case 0b000: d.op = BEQ; break;
+        case 0b001: d.op = BNE; break;
+        case 0b100: d.op = BLT; break;
+        case 0b101: d.op = BGE; break;
+      }
+      break;
+    }
+    case 0b0000011:
+      if (funct3 != 0b010) break;
+      d.op = LW;
+      d.imm = signExtend((code >> 20) & 0xFFF, 12);
+      break;
+    case 0b0100011:
+      if (funct3 != 0b010) break;
+      d.op = SW;
+      d.imm = signExtend(((code >> 7) & 31) | (((code >> 25) & 127) << 5), 12);
+      break;
+    case 0b0010011:
+      d.imm = signExtend((code >> 20) & 0xFFF, 12);
+      if (funct3 == 0b000) d.op = ADDI;
+      if (funct3 == 0b100) d.op = XORI;
+      break;
+    case 0b0110011:
+      switch (funct3 | (funct7 << 3)) {
+        case 0b0000000'000: d.op = ADD; break;
+        case 0b0100000'000: d.op = SUB; break;
+        case 0b0000000'001: d.op = SLL; break;
+        case 0b0000000'010: d.op = SLT; break;
+        case 0b0000001'010: d.op = SEQ; break;
+        case 0b0000011'010: d.op = SNE; break;
+        case 0b0000010'010: d.op = SGE; break;
+        case 0b0000000'100: d.op = XOR; break;
+        case 0b0000000'101: d.op = SRL; break;
+        case 0b0100000'101: d.op = SRA; break;
+        case 0b0000000'110: d.op = OR; break;
+        case 0b0000000'111: d.op = AND; break;
+        case 0b0000001'000: d.op = MUL; break;
+        case 0b0000001'100: d.op = DIV; break;
+        case 0b0000001'110: d.op = REM; break;
+      }
+      break;
+    case 0b1110011:
+      switch ((code >> 20) & 7) {
+        case 1: d.op = EBREAK; break;
+        case 2: d.op = EREAD; break;
+        case 4: d.op = EWRITE; break;
+      }
+      break;
+  }
+  return d;
+}
+
+struct OpInfo {
+  uint32_t opcode;
+  uint32_t funct3;
+  uint32_t funct7;
+  char type;
+};
+
+// Mirror of encodeCommand() in main.js
+const std::unordered_map<std::string, OpInfo> encodings = {
+    {"lui", {0b0110111, 0, 0, 'U'}},      {"jal", {0b1101111, 0, 0, 'U'}},
+    {"jalr", {0b1100111, 0, 0, 'I'}},     {"beq", {0b1100011, 0b000, 0, 'B'}},
+    {"bne", {0b1100011, 0b001, 0, 'B'}},  {"blt", {0b1100011, 0b100, 0, 'B'}},
+    {"bge", {0b1100011, 0b101, 0, 'B'}},  {"lw", {0b0000011, 0b010, 0, 'I'}},
+    {"sw", {0b0100011, 0b010, 0, 'S'}},   {"addi", {0b0010011, 0b000, 0, 'I'}},
+    {"xori", {0b0010011, 0b100, 0, 'I'}}, {"add", {0b0110011, 0b000, 0, 'R'}},
+    {"sub", {0b0110011, 0b000, 0b0100000, 'R'}},
+    {"sll", {0b0110011, 0b001, 0, 'R'}},
+    {"slt", {0b0110011, 0b010, 0, 'R'}},
+    {"seq", {0b0110011, 0b010, 0b0000001, 'R'}},
+    {"sne", {0b0110011, 0b010, 0b0000011, 'R'}},
+    {"sge", {0b0110011, 0b010, 0b0000010, 'R'}},
+    {"xor", {0b0110011, 0b100, 0, 'R'}},
+    {"srl", {0b0110011, 0b101, 0, 'R'}},
+    {"sra", {0b0110011, 0b101, 0b0100000, 'R'}},
+    {"or", {0b0110011, 0b110, 0, 'R'}},
+    {"and", {0b0110011, 0b111, 0, 'R'}},
+    {"mul", {0b0110011, 0b000, 0b0000001, 'R'}},
+    {"div", {0b0110011, 0b100, 0b0000001, 'R'}},
+    {"rem", {0b0110011, 0b110, 0b0000001, 'R'}},
+    {"ebreak", {0b1110011, 0, 0, 'E'}},   {"eread", {0b1110011, 0, 0, 'E'}},
+    {"ewrite", {0b1110011, 0, 0, 'E'}},
+};
+
+uint32_t encode(const std::string &op, int32_t a = 0, int32_t b = 0,
+                int32_t c = 0) {
+  const auto &e = encodings.at(op);
+  const uint32_t base = e.opcode | (e.funct3 << 12);
+  switch (e.type) {
+    case 'R':
+      return base | (e.funct7 << 25) | ((a & 31) << 7) | ((b & 31) << 15) |
+             ((c & 31) << 20);
+    case 'I':
+      return base | ((a & 31) << 7) | ((b & 31) << 15) | ((c & 0xFFF) << 20);
+    case 'S':
+      return base | ((a & 31) << 15) | ((c & 31) << 20) | ((b & 31) << 7) |
+             (((b >> 5) & 127) << 25);
+    case 'B':
+      return base | ((a & 31) << 15) | ((b & 31) << 20) |
+             (((c >> 10) & 1) << 7) | ((c & 15) << 8) |
+             (((c >> 4) & 63) << 25) | (((c >> 11) & 1) << 31);
+    case 'U':
+      return base | ((a & 31) << 7) | ((b & 0xFFFFF) << 12);
+    case 'E':
+      if (op == "ebreak") return base | (1 << 20);
+      if (op == "eread") return base | ((a & 31) << 7) | (2 << 20);
+      return base | ((a & 31) << 15) | (4 << 20);
+  }
+  return 0;
+}
+
+struct Operand {
+  enum Kind { REG, IMM, LABEL } kind;
+  int32_t value = 0;
+  std::string label = {};
+};
+
+struct Fixup {
+  size_t pos;
+  size_t line;
+  std::string op;
+  int32_t a, b;
+  std::string label;
+};
+
+class Assembler {
+ public:
+  std::vector<uint32_t> image;
+  std::vector<std::string> errors;
+
+  void line(std::string text, size_t line_no) {
+    if (auto hash = text.find('#'); hash != std::string::npos) text.resize(hash);
+    trim(text);
+    if (text.empty()) return;
+
+    if (text.back() == ':') {
+      labels[text.substr(0, text.size() - 1)] = image.size();
+      return;
+    }
+
+    const auto space = text.find_first_of(" \t");
+    std::string op = text.substr(0, space);
+    for (auto &ch : op) ch = std::tolower(ch);
+
+    if (op == "data") {
+      // data imm * t
+      const auto star = text.find('*');
+      int64_t val, times;
+      if (star == std::string::npos ||
+          !parseWord(text.substr(space, star - space), val) ||
+          !parseNumber(text.substr(star + 1), times) || times < 0 ||
+          times > MEMORY_SIZE) {
+        return error(line_no, text);
+      }
+      image.insert(image.end(), times, static_cast<uint32_t>(val));
+      return;
+    }
+
+    std::vector<Operand> args;
+    if (space != std::string::npos && !parseArgs(text.substr(space), args)) {
+      return error(line_no, text);
+    }
+
+    if (!encodings.count(op) && op != "li") return error(line_no, text);
+    const auto kinds = signature(args);
+
+    if (op == "li" && kinds == "ri") {
+      const int32_t imm = args[1].value;
+      const int rd = args[0].value;
+      if (-2048 <= imm && imm < 2048) {
+        image.push_back(encode("addi", rd, 0, imm));
+      } else {
+        const int32_t lows = signExtend(imm & 0xFFF, 12);
+        image.push_back(encode("lui", rd, (imm - lows) >> 12));
+        if (lows != 0) image.push_back(encode("addi", rd, rd, lows));
+      }
+    } else if (op == "li" && kinds == "rl") {
+      // always two cells, patched once the label address is known
+      fixups.push_back({image.size(), line_no, op, args[0].value, 0, args[1].label});
+      image.push_back(0);
+      image.push_back(0);
+    } else if (op == "jal" && kinds == "rl") {
+      fixups.push_back({image.size(), line_no, op, args[0].value, 0, args[1].label});
+      image.push_back(0);
+    } else if (encodings.at(op).type == 'B' && kinds == "rrl") {
+      fixups.push_back({image.size(), line_no, op, args[0].value, args[1].value,
+                        args[2].label});
+      image.push_back(0);
+    } else if (kinds == expected(op)) {
+      image.push_back(encode(op, args.size() > 0 ? args[0].value : 0,
+                             args.size() > 1 ? args[1].value : 0,
+                             args.size() > 2 ? args[2].value : 0));
+    } else {
+      error(line_no, text);
+    }
+  }
+
+  void finish() {
+    for (const auto &f : fixups) {
+      if (!labels.count(f.label)) {
+        errors.push_back("Unknown label '" + f.label + "' at line " +
+                         std::to_string(f.line));
+        continue;
+      }
+      const int32_t addr = labels.at(f.label);
+      const int32_t diff = addr - static_cast<int32_t>(f.pos) - 1;
+      if (f.op == "li") {
+        const int32_t lows = signExtend(addr & 0xFFF, 12);
+        image[f.pos] = encode("lui", f.a, (addr - lows) >> 12);
+        image[f.pos + 1] = encode("addi", f.a, f.a, lows);
+      } else if (f.op == "jal") {
+        image[f.pos] = encode("jal", f.a, diff);
+      } else {
+        if (diff < -2048 || diff > 2047) {
+          errors.push_back("Branch to '" + f.label + "' out of range at line " +
+                           std::to_string(f.line));
+        }
+        image[f.pos] = encode(f.op, f.a, f.b, diff);
+      }
+    }
+    if (image.size() > MEMORY_SIZE) {
+      errors.push_back("Program does not fit into memory");
+    }
+  }
+
+ private:
+  std::unordered_map<std::string, int32_t> labels;
+  std::vector<Fixup> fixups;
+
+  static void trim(std::string &s) {
+    const auto begin = s.find_first_not_of(" \t\r");
+    const auto end = s.find_last_not_of(" \t\r");
+    s = begin == std::string::npos ? "" : s.substr(begin, end - begin + 1);
+  }
+
+  // Decimal number with an optional sign and surrounding blanks, false if
+  // anything else is in `text`
+  static bool parseNumber(std::string text, int64_t &value) {
+    trim(text);
+    const char *begin = text.data();
+    const char *end = begin + text.size();
+    if (begin != end && *begin == '+') ++begin;
+    const auto [ptr, ec] = std::from_chars(begin, end, value);
+    return begin != end && ec == std::errc() && ptr == end;
+  }
+
+  // A number that fits into a memory word, signed or not
+  static bool parseWord(const std::string &text, int64_t &value) {
+    return parseNumber(text, value) && value >= INT32_MIN &&
+           value <= UINT32_MAX;
+  }
+
+  static bool parseArgs(const std::string &text, std::vector<Operand> &args) {
+    std::stringstream ss(text);
+    std::string item;
+    while (std::getline(ss, item, ',')) {
+      trim(item);
+      if (item.empty()) return false;
+      int64_t value;
+      if ((item[0] == 'x' || item[0] == 'X') && item.size() > 1 &&
+          std::isdigit(item[1])) {
+        if (!parseNumber(item.substr(1), value) || value > 31) return false;
+        args.push_back({Operand::REG, static_cast<int32_t>(value)});
+      } else if (std::isdigit(item[0]) || item[0] == '-' || item[0] == '+') {
+        if (!parseWord(item, value)) return false;
+        args.push_back({Operand::IMM, static_cast<int32_t>(value)});
+      } else {
+        args.push_back({Operand::LABEL, 0, item});
+      }
+    }
+    return true;
+  }
+
+  static std::string signature(const std::vector<Operand> &args) {
+    std::string res;
+    for (const auto &a : args) res += "ril"[a.kind];
+    return res;
+  }
+
+  static std::string expected(const std::string &op) {
+    if (op == "ebreak") return "";
+    if (op == "eread" || op == "ewrite") return "r";
+    if (op == "sw") return "rir";
+    switch (encodings.at(op).type) {
+      case 'R': return "rrr";
+      case 'I': return "rri";
+      case 'B': return "rri";
+      case 'U': return "ri";
+    }
+    return "?";
+  }
+
+  void error(size_t line_no, const std::string &text) {
+    errors.push_back("Unknown operator format: '" + text + "' at line " +
+                     std::to_string(line_no));
+  }
+};
+
+void writeUtf8(std::string &out, uint32_t cp) {
+  if (cp < 0x80) {
+    out += static_cast<char>(cp);
+  } else if (cp < 0x800) {
+    out += static_cast<char>(0xC0 | (cp >> 6));
+    out += static_cast<char>(0x80 | (cp & 0x3F));
+  } else if (cp < 0x10000) {
+    out += static_cast<char>(0xE0 | (cp >> 12));
+    out += static_cast<char>(0x80 | ((cp >> 6) & 0x3F));
+    out += static_cast<char>(0x80 | (cp & 0x3F));
+  } else {
+    out += static_cast<char>(0xF0 | ((cp >> 18) & 0x07));
+    out += static_cast<char>(0x80 | ((cp >> 12) & 0x3F));
+    out += static_cast<char>(0x80 | ((cp >> 6) & 0x3F));
+    out += static_cast<char>(0x80 | (cp & 0x3F));
+  }
+}
+
+int32_t readUtf8() {
+  int c = std::getchar();
+  if (c == EOF) return 0;
+  int extra = c >= 0xF0 ? 3 : c >= 0xE0 ? 2 : c >= 0xC0 ? 1 : 0;
+  int32_t cp = extra ? c & (0x3F >> extra) : c;
+  while (extra-- > 0) {
+    const int next = std::getchar();
+    if (next == EOF) break;
+    cp = (cp << 6) | (next & 0x3F);
+  }
+  return cp;
+}
+
+void flush(std::string &out) {
+  std::fwrite(out.data(), 1, out.size(), stdout);
+  out.clear();
+}
+
+// Runs until ebreak, an undecodable cell or the step limit. Returns the
+// number of executed instructions, m.out_of_steps tells whether the limit
+// stopped it.
+uint64_t run(Machine &m, uint64_t max_steps) {
+  static const void *dispatch[OP_COUNT] = {
+      &&op_halt, &&op_lui,  &&op_jal,    &&op_jalr,  &&op_beq,   &&op_bne,
+      &&op_blt,  &&op_bge,  &&op_lw,     &&op_sw,    &&op_addi,  &&op_xori,
+      &&op_add,  &&op_sub,  &&op_sll,    &&op_slt,   &&op_seq,   &&op_sne,
+      &&op_sge,  &&op_xor,  &&op_srl,    &&op_sra,   &&op_or,    &&op_and,
+      &&op_mul,  &&op_div,  &&op_rem,    &&op_ebreak, &&op_eread, &&op_ewrite,
+  };
+
+  int32_t *const x = m.regs;
+  int32_t *const mem = m.memory.data();
+  Decoded *const code = m.code.data();
+  std::string out;
+  uint64_t steps = 0;
+  uint64_t loads = 0;
+  uint64_t stores = 0;
+  uint64_t taken = 0;
+  uint64_t jumps = 0;
+  uint32_t pc = 0;
+  const Decoded *ins;
+
+  // pc points to the next instruction while the current one executes
+#define NEXT                                       \
+  do {                                             \
+    if (++steps > max_steps) goto op_halt;         \
+    ins = &code[pc++];                             \
+    goto *dispatch[ins->op];                       \
+  } while (0)
+#define JUMP(target)                               \
+  do {                                             \
+    pc = static_cast<uint32_t>(target);            \
+    if (pc >= MEMORY_SIZE) pc = MEMORY_SIZE;       \
+  } while (0)
+#define BRANCH(cond)                               \
+  do {                                             \
+    if (cond) {                                    \
+      ++taken;                                     \
+      JUMP(pc + ins->imm);                         \
+    }                                              \
+    NEXT;                                          \
+  } while (0)
+#define R(op_expr)                                 \
+  do {                                             \
+    const uint32_t a = x[ins->rs1];                \
+    const uint32_t b = x[ins->rs2];                \
+    x[ins->rd] = static_cast<int32_t>(op_expr);    \
+    NEXT;                                          \
+  } while (0)
+
+  NEXT;
+
+op_lui:
+  x[ins->rd] = ins->imm;
+  NEXT;
+op_jal:
+  ++jumps;
+  x[ins->rd] = pc;
+  JUMP(pc + ins->imm);
+  NEXT;
+op_jalr: {
+  ++jumps;
+  const int32_t target = x[ins->rs1] + ins->imm;
+  x[ins->rd] = pc;
+  JUMP(target);
+  NEXT;
+}
+op_beq:
+  BRANCH(x[ins->rs1] == x[ins->rs2]);
+op_bne:
+  BRANCH(x[ins->rs1] != x[ins->rs2]);
+op_blt:
+  BRANCH(x[ins->rs1] < x[ins->rs2]);
+op_bge:
+  BRANCH(x[ins->rs1] >= x[ins->rs2]);
+op_lw: {
+  ++loads;
+  const uint32_t addr = x[ins->rs1] + ins->imm;
+  x[ins->rd] = addr < MEMORY_SIZE ? mem[addr] : 0;
+  NEXT;
+}
+op_sw: {
+  ++stores;
+  const uint32_t addr = x[ins->rs1] + ins->imm;
+  if (addr < MEMORY_SIZE) {
+    mem[addr] = x[ins->rs2];
+    code[addr] = decode(mem[addr]);
+  }
+  NEXT;
+}
+op_addi:
+  x[ins->rd] = static_cast<int32_t>(static_cast<uint32_t>(x[ins->rs1]) + ins->imm);
+  NEXT;
+op_xori:
+  x[ins->rd] = x[ins->rs1] ^ ins->imm;
+  NEXT;
+op_add:
+  R(a + b);
+op_sub:
+  R(a - b);
+op_sll:
+  R(a << (b & 31));
+op_slt:
+  R(static_cast<int32_t>(a) < static_cast<int32_t>(b));
+op_seq:
+  R(a == b);
+op_sne:
+  R(a != b);
+op_sge:
+  R(static_cast<int32_t>(a) >= static_cast<int32_t>(b));
+op_xor:
+  R(a ^ b);
+op_srl:
+  R(a >> (b & 31));
+op_sra:
+  R(static_cast<int32_t>(a) >> (b & 31));
+op_or:
+  R(a | b);
+op_and:
+  R(a & b);
+op_mul:
+  R(a * b);
+  // division by zero yields 0 and INT_MIN / -1 wraps, as in main.js
+op_div:
+  R(b == 0 ? 0
+    : (b == 0xFFFFFFFFu) ? 0u - a
+                         : static_cast<int32_t>(a) / static_cast<int32_t>(b));
+op_rem:
+  R(b == 0 || b == 0xFFFFFFFFu
+        ? 0
+        : static_cast<int32_t>(a) % static_cast<int32_t>(b));
+op_eread:
+  flush(out);
+  x[ins->rd] = readUtf8();
+  NEXT;
+op_ewrite:
+  writeUtf8(out, static_cast<uint32_t>(x[ins->rs1]));
+  if (out.size() > (1 << 16)) flush(out);
+  NEXT;
+op_ebreak:
+op_halt:
+  x[ZERO_SINK] = 0;
+  flush(out);
+  std::fflush(stdout);
+  m.loads = loads;
+  m.stores = stores;
+  m.taken_branches = taken;
+  m.jumps = jumps;
+  m.out_of_steps = steps > max_steps;
+  return m.out_of_steps ? max_steps : steps;
+
+#undef R
+#undef BRANCH
+#undef JUMP
+#undef NEXT
+}
+
+bool parseSteps(std::string_view text, uint64_t &steps) {
+  const auto [ptr, ec] =
+      std::from_chars(text.data(), text.data() + text.size(), steps);
+  return !text.empty() && ec == std::errc() && ptr == text.data() + text.size();
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+  bool quiet = false;
+  uint64_t max_steps = UINT64_MAX;
+  const char *path = nullptr;
+
+  for (int i = 1; i < argc; ++i) {
+    const std::string arg = argv[i];
+    if (arg == "-q") {
+      quiet = true;
+    } else if (arg == "--max-steps" && i + 1 < argc &&
+               parseSteps(argv[i + 1], max_steps)) {
+      ++i;
+    } else if (arg[0] == '-' && arg.size() > 1) {
+      std::cerr << "usage: " << argv[0] << " [-q] [--max-steps N] [file.s]"
+                << std::endl;
+      return 2;
+    } else {
+      path = argv[i];
+    }
+  }
+
+  std::ifstream file;
+  if (path) {
+    file.open(path);
+    if (!file.is_open()) {
+      std::cerr << "Cannot open " << path << std::endl;
+      return 1;
+    }
+  }
+  std::istream &in = path ? file : std::cin;
+
+  Assembler assembler;
+  std::string text;
+  for (size_t line_no = 0; std::getline(in, text); ++line_no) {
+    assembler.line(text, line_no);
+  }
+  assembler.finish();
+  if (!assembler.errors.empty()) {
+    for (const auto &e : assembler.errors) std::cerr << e << std::endl;
+    return 1;
+  }
+
+  Machine m;
+  for (size_t i = 0; i < assembler.image.size(); ++i) {
+    m.memory[i] = static_cast<int32_t>(assembler.image[i]);
+  }
+  for (size_t i = 0; i < MEMORY_SIZE; ++i) {
+    m.code[i] = decode(m.memory[i]);
+  }
+
+  const auto start = std::chrono::steady_clock::now();
+  const uint64_t steps = run(m, max_steps);
+  const std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - start;
+
+  if (!quiet) {
+    std::fprintf(stderr, "instructions: %llu\n",
+                 static_cast<unsigned long long>(steps));
+    std::fprintf(stderr, "loads: %llu\n",
+                 static_cast<unsigned long long>(m.loads));
+    std::fprintf(stderr, "stores: %llu\n",
+                 static_cast<unsigned long long>(m.stores));
+    std::fprintf(stderr, "taken branches: %llu\n",
+                 static_cast<unsigned long long>(m.taken_branches));
+    std::fprintf(stderr, "jumps: %llu\n",
+                 static_cast<unsigned long long>(m.jumps));
+    std::fprintf(stderr, "time: %.6f s\n", elapsed.count());
+    std::fprintf(stderr, "MIPS: %.1f\n",
+                 elapsed.count() > 0 ? steps / elapsed.count() / 1e6 : 0.0);
+  }
+  if (m.out_of_steps) {
+    // the counts above are of a partial run
+    std::fprintf(stderr, "stopped after --max-steps %llu instructions\n",
+                 static_cast<unsigned long long>(max_steps));
+    return 1;
+  }
+  return 0;
+}
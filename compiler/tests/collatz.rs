@@ -0,0 +1,26 @@
+// Longest Collatz chain for a start below the limit
+let limit = 3000;
+let best = 0;
+let best_start = 0;
+
+for let start = 1; start < limit; start += 1 {
+    let n = start;
+    let steps = 0;
+    while n != 1 {
+        if n % 2 == 0 {
+            n = n / 2;
+        } else {
+            n = 3 * n + 1;
+        }
+        steps += 1;
+    }
+    if steps > best {
+        best = steps;
+        best_start = start;
+    }
+}
+
+print!("longest chain starts at ");
+print!(best_start);
+print!("steps: ");
+print!(best);
@@ -0,0 +1,19 @@
+// Sum of gcd(a, b) over a small grid, Euclid with remainders
+let size = 60;
+let total = 0;
+
+for let a = 1; a <= size; a += 1 {
+    for let b = 1; b <= size; b += 1 {
+        let x = a;
+        let y = b;
+        while y != 0 {
+            let t = x % y;
+            x = y;
+            y = t;
+        }
+        total += x;
+    }
+}
+
+print!("sum of gcds: ");
+print!(total);
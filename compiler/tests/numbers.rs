@@ -0,0 +1,14 @@
+// Output-heavy: prints a table of squares and cubes, signs alternating
+let n = 1;
+for let i = 1; i <= 300; i += 1 {
+    let square = i * i;
+    let cube = square * i;
+    if i % 2 == 0 {
+        print!(0 - square);
+    } else {
+        print!(square);
+    }
+    print!(cube);
+    n = n * 7 + i;
+    print!(n);
+}
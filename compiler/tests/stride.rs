@@ -0,0 +1,15 @@
+// Walks a virtual 2D grid row by row, offsets are products with the counter
+let width = 37;
+let total = 0;
+for let row = 0; row < 400; row += 1 {
+    let left = row * 37 % 101;
+    let right = (row * 37 + width) % 103;
+    total += left * right + row * 37 / 7;
+}
+print!(total);
+
+let checksum = 0;
+for let i = 0; i < 3000; i += 1 {
+    checksum += i * 5 % 13 + i * 3 % 11;
+}
+print!(checksum);
@@ -0,0 +1,29 @@
+// Counts vowels and words in a string, reading it char by char
+let text = "the quick brown fox jumps over the lazy dog while the five boxing wizards jump quickly and a mad boxer shot a quick gloved jab to the jaw of his dizzy opponent";
+let rounds = 20;
+let vowels = 0;
+let words = 0;
+let length = len!(text);
+
+for let r = 0; r < rounds; r += 1 {
+    let in_word = 0;
+    for let i = 0; i < length; i += 1 {
+        let c = text[i];
+        if c == 97 || c == 101 || c == 105 || c == 111 || c == 117 {
+            vowels += 1;
+        }
+        if c == 32 {
+            in_word = 0;
+        } else {
+            if !in_word {
+                in_word = 1;
+                words += 1;
+            }
+        }
+    }
+}
+
+print!("vowels: ");
+print!(vowels);
+print!("words: ");
+print!(words);